@@ -0,0 +1,172 @@
+//=================================================================================================
+// BitStats.cpp - Implements a class that counts, for every bit of a set of registers, how often
+//                the bit toggles and how often it's set
+//
+// Counting each bit of each sample one at a time would cost 64 operations per sample per pair of
+// registers.  Instead, each pair of registers is packed into a 64-bit word and counted with
+// bit-sliced ("vertical") counters: plane k of a word holds bit k of all 64 counts.  Adding a
+// word of bits is then a ripple-carry of AND/XOR operations on whole words.  The planes are
+// stored plane-major, so each step of the ripple is a loop over contiguous words that the
+// compiler can spread across SIMD lanes.
+//
+// With PLANES planes, the counters overflow after 2^PLANES - 1 samples, so at that point they
+// are flushed into 64-bit totals.  Only the set bits of each plane are visited during a flush.
+//
+// A bit toggles when it differs from the same bit in the previous sample (cur XOR prev).
+// A bit is stuck low if the OR of every sample is 0 there, and stuck high if the AND is 1.
+//=================================================================================================
+#include <string.h>
+#include "BitStats.h"
+using namespace std;
+
+// The number of bit-planes in each counter
+static const int      PLANES = 8;
+static const uint32_t FLUSH_INTERVAL = (1 << PLANES) - 1;
+
+
+//=================================================================================================
+// Constructor - Sizes everything for the specified number of registers
+//=================================================================================================
+BitStats::BitStats(size_t registers)
+{
+    registers_ = registers;
+    words_     = (registers + 1) / 2;
+
+    current_    .assign(words_, 0);
+    previous_   .assign(words_, 0);
+    toggleCarry_.assign(words_, 0);
+    oneCarry_   .assign(words_, 0);
+    togglePlane_.assign(words_ * PLANES, 0);
+    onePlane_   .assign(words_ * PLANES, 0);
+    toggleTotal_.assign(words_ * 64, 0);
+    oneTotal_   .assign(words_ * 64, 0);
+    allAnd_     .assign(words_, ~0ULL);
+    allOr_      .assign(words_, 0);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// accumulate() - Adds 'carry' (one bit per counter) into a set of bit-sliced counters
+//
+// On Exit: 'carry' has been overwritten
+//=================================================================================================
+inline void BitStats::accumulate(uint64_t* plane, uint64_t* carry, size_t words)
+{
+    for (int k=0; k<PLANES; ++k, plane += words)
+    {
+        for (size_t w=0; w<words; ++w)
+        {
+            uint64_t c = plane[w] & carry[w];
+            plane[w] ^= carry[w];
+            carry[w]  = c;
+        }
+    }
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// add() - Adds one sample to the counts
+//=================================================================================================
+void BitStats::add(const uint32_t* value)
+{
+    // Pack the registers two to a word
+    for (size_t r=0; r<registers_; r += 2)
+    {
+        uint64_t high = (r + 1 < registers_) ? value[r + 1] : 0;
+        current_[r / 2] = ((uint64_t)high << 32) | value[r];
+    }
+
+    // The first sample has nothing to toggle from
+    bool first = (samples_ == 0);
+
+    for (size_t w=0; w<words_; ++w)
+    {
+        uint64_t bits = current_[w];
+        allAnd_[w]      &= bits;
+        allOr_[w]       |= bits;
+        oneCarry_[w]     = bits;
+        toggleCarry_[w]  = bits ^ previous_[w];
+    }
+
+    accumulate(onePlane_.data(), oneCarry_.data(), words_);
+    if (!first) accumulate(togglePlane_.data(), toggleCarry_.data(), words_);
+
+    current_.swap(previous_);
+    ++samples_;
+
+    // Don't let the bit-sliced counters overflow
+    if (++pending_ == FLUSH_INTERVAL) flush();
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// flush() - Moves the bit-sliced counters into the 64-bit totals and clears them
+//=================================================================================================
+void BitStats::flush()
+{
+    for (int k=0; k<PLANES; ++k)
+    {
+        for (size_t w=0; w<words_; ++w)
+        {
+            // Only the bit positions that have bit k set in their count need visiting
+            for (uint64_t bits = togglePlane_[k * words_ + w]; bits; bits &= bits - 1)
+            {
+                toggleTotal_[w * 64 + __builtin_ctzll(bits)] += 1ULL << k;
+            }
+
+            for (uint64_t bits = onePlane_[k * words_ + w]; bits; bits &= bits - 1)
+            {
+                oneTotal_[w * 64 + __builtin_ctzll(bits)] += 1ULL << k;
+            }
+        }
+    }
+
+    memset(togglePlane_.data(), 0, togglePlane_.size() * sizeof(uint64_t));
+    memset(onePlane_.data(),    0, onePlane_.size()    * sizeof(uint64_t));
+
+    pending_ = 0;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// toggles() / ones() - Return the counts for one bit, including any that haven't been flushed
+//=================================================================================================
+uint64_t BitStats::toggles(size_t reg, int bit) const
+{
+    size_t   w     = reg / 2;
+    int      b     = (reg & 1) * 32 + bit;
+    uint64_t total = toggleTotal_[w * 64 + b];
+    for (int k=0; k<PLANES; ++k) total += ((togglePlane_[k * words_ + w] >> b) & 1) << k;
+    return total;
+}
+
+uint64_t BitStats::ones(size_t reg, int bit) const
+{
+    size_t   w     = reg / 2;
+    int      b     = (reg & 1) * 32 + bit;
+    uint64_t total = oneTotal_[w * 64 + b];
+    for (int k=0; k<PLANES; ++k) total += ((onePlane_[k * words_ + w] >> b) & 1) << k;
+    return total;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// stuckLow() / stuckHigh() - Return the masks of bits that never changed from 0 (or from 1)
+//=================================================================================================
+uint32_t BitStats::stuckLow(size_t reg) const
+{
+    if (samples_ == 0) return 0;
+    return ~(uint32_t)(allOr_[reg / 2] >> ((reg & 1) * 32));
+}
+
+uint32_t BitStats::stuckHigh(size_t reg) const
+{
+    if (samples_ == 0) return 0;
+    return (uint32_t)(allAnd_[reg / 2] >> ((reg & 1) * 32));
+}
+//=================================================================================================
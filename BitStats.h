@@ -0,0 +1,62 @@
+//=================================================================================================
+// BitStats.h - Defines a class that counts, for every bit of a set of registers, how often the
+//              bit toggles and how often it's set
+//=================================================================================================
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+class BitStats
+{
+public:
+
+    // Constructor: 'registers' is the number of 32-bit registers in each sample
+    BitStats(size_t registers);
+
+    // Adds one sample: one value per register
+    void        add(const uint32_t* value);
+
+    // Number of samples added so far
+    uint64_t    samples() const {return samples_;}
+
+    // Number of times bit 'bit' of register 'reg' differed from the previous sample
+    uint64_t    toggles(size_t reg, int bit) const;
+
+    // Number of samples in which bit 'bit' of register 'reg' was set
+    uint64_t    ones(size_t reg, int bit) const;
+
+    // Masks of the bits of register 'reg' that were 0 (or 1) in every sample
+    uint32_t    stuckLow (size_t reg) const;
+    uint32_t    stuckHigh(size_t reg) const;
+
+protected:
+
+    // Moves the bit-sliced counters into the totals
+    void        flush();
+
+    // Adds one bit per counter to a set of bit-sliced counters
+    static inline void accumulate(uint64_t* plane, uint64_t* carry, size_t words);
+
+    // The registers are packed two to a 64-bit word, so every operation covers 64 bits at once
+    size_t      registers_, words_;
+
+    // Each sample as packed words, and the previous one
+    std::vector<uint64_t> current_, previous_;
+
+    // The bits being added to the counters: the toggles and the ones of the current sample
+    std::vector<uint64_t> toggleCarry_, oneCarry_;
+
+    // Bit-sliced counters, plane-major.  Word 'w' of plane 'k' holds bit 'k' of the count for
+    // each of the 64 bits of word 'w', so adding a word of bits is a ripple-carry through the planes.
+    std::vector<uint64_t> togglePlane_, onePlane_;
+
+    // The totals for every bit, updated each time the bit-sliced counters are about to overflow
+    std::vector<uint64_t> toggleTotal_, oneTotal_;
+
+    // The AND and the OR of every sample
+    std::vector<uint64_t> allAnd_, allOr_;
+
+    uint64_t    samples_ = 0;
+    uint32_t    pending_ = 0;
+};
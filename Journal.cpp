@@ -0,0 +1,203 @@
+//=================================================================================================
+// Journal.cpp - Implements an append-only binary journal of register writes
+//=================================================================================================
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdexcept>
+#include "Journal.h"
+using namespace std;
+
+// This is the journal that the register access routines write into
+Journal WriteJournal;
+
+// Identifies a journal file, and the layout of its records
+static const char     JOURNAL_MAGIC[8] = {'P','C','I','R','J','R','N','L'};
+static const uint32_t JOURNAL_VERSION  = 2;
+
+// Other processes (and the decoder) depend on this layout
+static_assert(sizeof(Journal::header_t) == 64, "journal header must be 64 bytes");
+static_assert(sizeof(Journal::record_t) == 32, "journal records must be 32 bytes");
+
+
+//=================================================================================================
+// timestamp() - Returns the wall-clock time in nanoseconds since the Unix epoch
+//=================================================================================================
+int64_t Journal::timestamp()
+{
+    timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// open() - Opens a journal file, creating and initializing it if it doesn't exist yet
+//
+// Passed: filename = the name of the journal file
+//         capacity = how many records the ring holds, if we have to create the file
+//=================================================================================================
+void Journal::open(string filename, uint64_t capacity)
+{
+    header_t header;
+    struct stat sb;
+
+    close();
+
+    // Open the file, creating it if necessary
+    int fd = ::open(filename.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0) throw runtime_error("pcireg : cant open journal " + filename);
+
+    // Make sure no other process is initializing the file while we look at it
+    flock(fd, LOCK_EX);
+    fstat(fd, &sb);
+
+    // If the file is brand new, build a header for it
+    if (sb.st_size == 0)
+    {
+        memset((void*)&header, 0, sizeof header);
+        memcpy(header.magic, JOURNAL_MAGIC, sizeof header.magic);
+        header.version    = JOURNAL_VERSION;
+        header.recordSize = sizeof(record_t);
+        header.capacity   = capacity;
+        if (pwrite(fd, &header, sizeof header, 0) != sizeof header ||
+            ftruncate(fd, sizeof header + capacity * sizeof(record_t)) != 0)
+        {
+            ::close(fd);
+            throw runtime_error("pcireg : cant initialize journal " + filename);
+        }
+    }
+
+    // Otherwise, fetch the existing header and make sure it's one of ours
+    else if (pread(fd, &header, sizeof header, 0) != sizeof header
+         ||  memcmp(header.magic, JOURNAL_MAGIC, sizeof header.magic) != 0
+         ||  header.version    != JOURNAL_VERSION
+         ||  header.recordSize != sizeof(record_t))
+    {
+        ::close(fd);
+        throw runtime_error("pcireg : " + filename + " is not a pcireg journal");
+    }
+
+    // A journal that was truncated or damaged (say, by the crash we're investigating) must not
+    // be mapped past its end, or divided into zero slots
+    fstat(fd, &sb);
+    if (header.capacity == 0
+    ||  header.capacity > (uint64_t)(sb.st_size - sizeof(header_t)) / sizeof(record_t))
+    {
+        ::close(fd);
+        throw runtime_error("pcireg : journal " + filename + " is truncated or corrupt");
+    }
+
+    // Map the header and the ring into memory
+    mapSize_ = sizeof(header_t) + header.capacity * sizeof(record_t);
+    void* ptr = mmap(0, mapSize_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    // Once it's mapped, we don't need the file descriptor (which also releases the lock)
+    ::close(fd);
+
+    if (ptr == MAP_FAILED) throw runtime_error("pcireg : cant map journal " + filename);
+
+    header_ = (header_t*)ptr;
+    ring_   = (record_t*)(header_ + 1);
+    pid_    = getpid();
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// close() - Unmaps the journal
+//=================================================================================================
+void Journal::close()
+{
+    if (header_) munmap(header_, mapSize_);
+    header_ = nullptr;
+    ring_   = nullptr;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// record() - Appends a record to the journal
+//
+// Any number of processes may be appending at once.  Each one owns the slot it reserved, and
+// publishes the record by storing its sequence number last.
+//=================================================================================================
+void Journal::record(uint32_t offset, uint32_t oldValue, bool oldValid, uint32_t newValue)
+{
+    // Reserve the next slot in the ring
+    uint64_t index = header_->head.fetch_add(1, memory_order_relaxed);
+    record_t& r = ring_[index % header_->capacity];
+
+    // Mark the slot as incomplete while we fill it in
+    __atomic_store_n(&r.seq, 0, __ATOMIC_RELAXED);
+    atomic_thread_fence(memory_order_release);
+
+    r.timeNs   = timestamp();
+    r.pid      = pid_;
+    r.offset   = offset;
+    r.oldValue = oldValue;
+    r.newValue = newValue;
+    r.source   = source_;
+    r.flags    = oldValid ? OLD_VALID : 0;
+
+    // And publish it
+    __atomic_store_n(&r.seq, (uint32_t)(index + 1), __ATOMIC_RELEASE);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// readAll() - Returns a copy of every complete record still in the ring, oldest first
+//
+// A record is skipped if its sequence number doesn't match its position, which means it was
+// still being written, or was overwritten while we were copying it.
+//=================================================================================================
+vector<Journal::record_t> Journal::readAll() const
+{
+    vector<record_t> result;
+
+    uint64_t head     = header_->head.load(memory_order_acquire);
+    uint64_t capacity = header_->capacity;
+    uint64_t first    = (head > capacity) ? head - capacity : 0;
+
+    result.reserve(head - first);
+
+    for (uint64_t index = first; index < head; ++index)
+    {
+        const record_t& r = ring_[index % capacity];
+
+        uint32_t seq = __atomic_load_n(&r.seq, __ATOMIC_ACQUIRE);
+        record_t copy = r;
+        atomic_thread_fence(memory_order_acquire);
+
+        if (seq == (uint32_t)(index + 1) && __atomic_load_n(&r.seq, __ATOMIC_RELAXED) == seq)
+        {
+            result.push_back(copy);
+        }
+    }
+
+    return result;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// sourceName() - Returns the name of a source tag
+//=================================================================================================
+const char* Journal::sourceName(uint16_t source)
+{
+    switch (source)
+    {
+        case SRC_CLI:    return "cli";
+        case SRC_BENCH:  return "bench";
+        case SRC_FUSE:   return "fuse";
+        case SRC_REMOTE: return "remote";
+        default:         return "unknown";
+    }
+}
+//=================================================================================================
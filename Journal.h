@@ -0,0 +1,98 @@
+//=================================================================================================
+// Journal.h - Defines an append-only binary journal of register writes
+//
+// The journal is a ring of fixed-size records in a memory-mapped file that any number of
+// processes may share.  A writer reserves a slot with a single atomic increment of the ring's
+// head counter and then stores its record straight into the mapping, so journaling a write
+// costs no system calls.  The page cache takes care of getting the records to disk.
+//=================================================================================================
+#pragma once
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include <vector>
+
+class Journal
+{
+public:
+
+    // Identifies which part of pcireg made a write
+    enum source_t : uint16_t {SRC_UNKNOWN, SRC_CLI, SRC_BENCH, SRC_FUSE, SRC_REMOTE};
+
+    // Flag bits in a record
+    enum : uint16_t {OLD_VALID = 1};
+
+    // A single journal record.  'seq' is written last, and is what tells a reader that the
+    // rest of the record is complete
+    struct record_t
+    {
+        int64_t  timeNs;        // Wall-clock time, in nanoseconds since the Unix epoch
+        uint32_t pid;
+        uint32_t offset;
+        uint32_t oldValue;
+        uint32_t newValue;
+        uint32_t seq;
+        uint16_t source;
+        uint16_t flags;
+    };
+
+    // The header at the start of the journal file
+    struct header_t
+    {
+        char                  magic[8];
+        uint32_t              version;
+        uint32_t              recordSize;
+        uint64_t              capacity;       // Number of records the ring holds
+        std::atomic<uint64_t> head;           // Number of records ever reserved
+        uint8_t               reserved[32];
+    };
+
+    // Default constructor
+    Journal() {};
+
+    // Destructor
+    ~Journal() {close();}
+
+    // No copy or assignment constructor - objects of this class can't be copied
+    Journal (const Journal&) = delete;
+    Journal& operator= (const Journal&) = delete;
+
+    // Opens (and if necessary creates) a journal file that holds 'capacity' records
+    void        open(std::string filename, uint64_t capacity = 1 << 20);
+
+    // Unmaps the journal
+    void        close();
+
+    // True if the journal is open
+    bool        isOpen() const {return header_ != nullptr;}
+
+    // Sets the source tag that gets stored in each record this process writes
+    void        setSource(source_t source) {source_ = source;}
+
+    // Appends a record.  'oldValue' is ignored unless 'oldValid' is true
+    void        record(uint32_t offset, uint32_t oldValue, bool oldValid, uint32_t newValue);
+
+    // Returns a consistent copy of every record still in the ring, oldest first
+    std::vector<record_t> readAll() const;
+
+    // Returns the name of a source tag
+    static const char* sourceName(uint16_t source);
+
+    // Returns the wall-clock time in nanoseconds since the Unix epoch.  The journal outlives
+    // reboots, so records can't be stamped with anything that restarts at boot, like the TSC.
+    static int64_t timestamp();
+
+protected:
+
+    // The mapped header, and the records that follow it
+    header_t*   header_  = nullptr;
+    record_t*   ring_    = nullptr;
+    size_t      mapSize_ = 0;
+
+    // The source tag and the pid that we stamp into our records
+    uint16_t    source_  = SRC_UNKNOWN;
+    uint32_t    pid_     = 0;
+};
+
+// This is the journal that the register access routines write into
+extern Journal WriteJournal;
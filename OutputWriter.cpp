@@ -0,0 +1,251 @@
+//=================================================================================================
+// OutputWriter.cpp - Implements a buffered writer for emitting large numbers of register values
+//=================================================================================================
+#include <string.h>
+#include "OutputWriter.h"
+using namespace std;
+
+// Every two-digit decimal number, "00" thru "99"
+static const char decPairs[] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+// Every byte as a pair of upper-case hex digits, built on first use
+static const char* hexPairs()
+{
+    static char table[512];
+    static bool built = false;
+    if (!built)
+    {
+        const char* digit = "0123456789ABCDEF";
+        for (int i=0; i<256; ++i)
+        {
+            table[2*i]   = digit[i >> 4];
+            table[2*i+1] = digit[i & 15];
+        }
+        built = true;
+    }
+    return table;
+}
+
+
+//=================================================================================================
+// Constructor
+//=================================================================================================
+OutputWriter::OutputWriter(FILE* ofile, size_t bufferSize) : ofile_(ofile), buffer_(bufferSize)
+{
+    hexPairs();
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// parseFormat() - Parses the name of an output format
+//=================================================================================================
+bool OutputWriter::parseFormat(const char* name, format_t* format)
+{
+    if      (strcmp(name, "text") == 0) *format = FMT_TEXT;
+    else if (strcmp(name, "csv" ) == 0) *format = FMT_CSV;
+    else if (strcmp(name, "json") == 0) *format = FMT_JSON;
+    else if (strcmp(name, "bin" ) == 0) *format = FMT_BINARY;
+    else return false;
+    return true;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// put() - Appends raw text to the output
+//=================================================================================================
+void OutputWriter::put(const char* s, size_t len)
+{
+    while (len)
+    {
+        if (pos_ == buffer_.size()) flush();
+        size_t chunk = min(len, buffer_.size() - pos_);
+        memcpy(&buffer_[pos_], s, chunk);
+        pos_ += chunk;
+        s    += chunk;
+        len  -= chunk;
+    }
+}
+
+void OutputWriter::put(const char* s)
+{
+    put(s, strlen(s));
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// putHex() - Appends a value as exactly 'digits' upper-case hex digits (1 thru 16)
+//=================================================================================================
+void OutputWriter::putHex(uint64_t value, int digits)
+{
+    const char* pairs = hexPairs();
+    char        text[16];
+    char*       out = text + 16;
+
+    // Convert a byte at a time, from the right
+    for (int i=0; i<8; ++i)
+    {
+        out -= 2;
+        memcpy(out, pairs + 2 * (value & 0xFF), 2);
+        value >>= 8;
+    }
+
+    put(text + 16 - digits, digits);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// putDec() - Appends a value in decimal, converting two digits at a time
+//=================================================================================================
+void OutputWriter::putDec(uint64_t value)
+{
+    char  text[20];
+    char* out = text + 20;
+
+    while (value >= 100)
+    {
+        out -= 2;
+        memcpy(out, decPairs + 2 * (value % 100), 2);
+        value /= 100;
+    }
+
+    if (value >= 10)
+    {
+        out -= 2;
+        memcpy(out, decPairs + 2 * value, 2);
+    }
+    else *--out = '0' + value;
+
+    put(out, text + 20 - out);
+}
+
+void OutputWriter::putDec(int64_t value)
+{
+    if (value < 0)
+    {
+        put('-');
+        putDec((uint64_t)0 - (uint64_t)value);
+    }
+    else putDec((uint64_t)value);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// putJson() - Appends a string as a quoted JSON string.  Quotes, backslashes and control
+//             characters are escaped; everything else is copied as-is.
+//=================================================================================================
+void OutputWriter::putJson(const string& s)
+{
+    const char* pairs = hexPairs();
+
+    put('"');
+    for (unsigned char c : s)
+    {
+        if (c == '"' || c == '\\')
+        {
+            put('\\');
+            put(c);
+        }
+        else if (c < 0x20)
+        {
+            put("\\u00");
+            put(pairs + 2 * c, 2);
+        }
+        else put(c);
+    }
+    put('"');
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// record() - Emits one register value in the selected machine-readable format
+//
+//   FMT_CSV    : timestamp,name,address,value   (preceded by a header line)
+//   FMT_JSON   : {"ts":...,"name":"...","addr":"0x...","value":...}   (one object per line)
+//   FMT_BINARY : one binRecord_t
+//=================================================================================================
+void OutputWriter::record(int64_t timestamp, const string& name, uint32_t axiAddr, uint64_t value,
+                          bool wide)
+{
+    switch (format_)
+    {
+        case FMT_CSV:
+            if (!csvHeaderDone_)
+            {
+                put("timestamp,name,address,value\n");
+                csvHeaderDone_ = true;
+            }
+            putDec(timestamp);
+            put(',');
+            put(name);
+            put(",0x");
+            putHex(axiAddr, 8);
+            put(',');
+            putDec(value);
+            put('\n');
+            break;
+
+        case FMT_JSON:
+            put("{\"ts\":");
+            putDec(timestamp);
+            put(",\"name\":");
+            putJson(name);
+            put(",\"addr\":\"0x");
+            putHex(axiAddr, 8);
+            put("\",\"value\":");
+            putDec(value);
+            put("}\n");
+            break;
+
+        case FMT_BINARY:
+        {
+            binRecord_t r = {timestamp, axiAddr, wide ? 64U : 32U, value};
+            put((const char*)&r, sizeof r);
+            break;
+        }
+
+        default:
+            break;
+    }
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// period() - Emits the sampling period that an adaptive register has moved to
+//
+// A binary record has no name, so the period is told apart from a value by its width of 0, and
+// from the periods of other registers by the register's own address.
+//=================================================================================================
+void OutputWriter::period(int64_t timestamp, const string& name, uint32_t axiAddr, uint64_t periodUs)
+{
+    if (format_ == FMT_BINARY)
+    {
+        binRecord_t r = {timestamp, axiAddr, 0, periodUs};
+        put((const char*)&r, sizeof r);
+        return;
+    }
+
+    record(timestamp, name + "@period_us", axiAddr, periodUs);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// flush() - Writes any buffered output to the file
+//=================================================================================================
+void OutputWriter::flush()
+{
+    if (pos_) fwrite(buffer_.data(), 1, pos_, ofile_);
+    fflush(ofile_);
+    pos_ = 0;
+}
+//=================================================================================================
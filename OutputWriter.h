@@ -0,0 +1,81 @@
+//=================================================================================================
+// OutputWriter.h - Defines a buffered writer for emitting large numbers of register values
+//
+// Values are formatted with lookup tables rather than printf, and output goes to the file in
+// large chunks, so emitting millions of values isn't bottlenecked on stdio.
+//=================================================================================================
+#pragma once
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+class OutputWriter
+{
+public:
+
+    // The machine-readable formats that record() can emit.  FMT_TEXT means "the caller formats
+    // its own human-readable output with the put...() routines"
+    enum format_t {FMT_TEXT, FMT_CSV, FMT_JSON, FMT_BINARY};
+
+    // A record in FMT_BINARY output
+    struct binRecord_t
+    {
+        int64_t  timestamp;     // Nanoseconds since the Unix epoch
+        uint32_t axiAddr;
+        uint32_t width;         // 32 or 64, or 0 if 'value' is the register's sampling period in us
+        uint64_t value;
+    };
+
+    // Constructor
+    OutputWriter(FILE* ofile = stdout, size_t bufferSize = 1 << 16);
+
+    // Destructor - flushes any buffered output
+    ~OutputWriter() {flush();}
+
+    // No copy or assignment constructor - objects of this class can't be copied
+    OutputWriter (const OutputWriter&) = delete;
+    OutputWriter& operator= (const OutputWriter&) = delete;
+
+    // Selects the format that record() emits
+    void     setFormat(format_t format) {format_ = format;}
+    format_t format() const {return format_;}
+
+    // Parses a format name ("text", "csv", "json" or "bin").  Returns false if it's unknown
+    static bool parseFormat(const char* name, format_t* format);
+
+    // Emits one register value in the selected machine-readable format
+    void     record(int64_t timestamp, const std::string& name, uint32_t axiAddr, uint64_t value,
+                    bool wide = false);
+
+    // Emits the sampling period (in microseconds) that an adaptive register has moved to.  In
+    // text, CSV and JSON it's a record for "<name>@period_us"; in binary, a record of width 0.
+    void     period(int64_t timestamp, const std::string& name, uint32_t axiAddr, uint64_t periodUs);
+
+    // Appends raw text
+    void     put(char c)                    {if (pos_ == buffer_.size()) flush(); buffer_[pos_++] = c;}
+    void     put(const char* s, size_t len);
+    void     put(const char* s);
+    void     put(const std::string& s)      {put(s.data(), s.size());}
+
+    // Appends a value as exactly 'digits' upper-case hex digits
+    void     putHex(uint64_t value, int digits);
+
+    // Appends a value in decimal
+    void     putDec(uint64_t value);
+    void     putDec(int64_t value);
+
+    // Appends a string as a quoted JSON string, escaping whatever JSON requires
+    void     putJson(const std::string& s);
+
+    // Writes any buffered output to the file
+    void     flush();
+
+protected:
+
+    FILE*               ofile_;
+    std::vector<char>   buffer_;
+    size_t              pos_ = 0;
+    format_t            format_ = FMT_TEXT;
+    bool                csvHeaderDone_ = false;
+};
@@ -9,7 +9,9 @@
 #include <string.h>
 #include <fcntl.h>
 #include <sys/mman.h>
+#include <chrono>
 #include "PciDevice.h"
+#include "Probes.h"
 using namespace std;
 
 const char* c(const string& s) {return s.c_str();}
@@ -92,9 +94,21 @@ void PciDevice::mapResources()
     // Loop through each entry in the list of memory-mappable resources for this PCI device
     for (auto& bar : resource_)
     {
+        // Only a tracer wants to know how long the mapping takes
+        auto startTime = PROBE_ENABLED(device_map) ? chrono::steady_clock::now()
+                                                   : chrono::steady_clock::time_point();
+
         // Map the resources of this PCI device's BAR into our user-space memory map
         void* ptr = ::mmap(0, bar.size, protection, MAP_SHARED, fd, bar.physAddr);
 
+        // Let any attached tracer know how long the mapping took
+        if (PROBE_ENABLED(device_map))
+        {
+            auto latency = chrono::steady_clock::now() - startTime;
+            PROBE4(device_map, &bar - &resource_[0], bar.physAddr, bar.size,
+                   chrono::duration_cast<chrono::nanoseconds>(latency).count());
+        }
+
         // If a mapping error occurs, don't continue trying to map resources
         if (ptr == MAP_FAILED) 
         {
@@ -145,6 +159,10 @@ void PciDevice::close()
 
     // Delete the list of memory-mapped resources
     resource_.clear();
+
+    // If we were talking to a server, hang up
+    if (isRemote()) Remote = nullptr;
+    remote_.close();
 }
 //=================================================================================================
 
@@ -279,6 +297,12 @@ void PciDevice::open(int vendorID, int deviceID, string deviceDir)
     // If we couldn't find a device with that vendor ID and device ID, complain
     if (!found) throwRuntime("No PCI device found for vendor=0x%X, device=0x%X", vendorID, deviceID);
 
+    PROBE2(device_open, vendorID, deviceID);
+
+    // Remember where this device lives.  Link information is fetched only if someone asks.
+    deviceDir_    = dirName;
+    haveLinkInfo_ = false;
+
     // Fetch the physical address and size of each resource (i.e. BAR) that our device supports
     resource_ = getResourceList(dirName);
 
@@ -286,3 +310,215 @@ void PciDevice::open(int vendorID, int deviceID, string deviceDir)
     mapResources();
 }
 //=================================================================================================
+
+
+//=================================================================================================
+// openRemote() - Connects to a pcireg server and fetches the sizes of its regions
+//
+// Passed: endpoint = "unix:/path/to/socket" or "host:port"
+//=================================================================================================
+void PciDevice::openRemote(const string& endpoint)
+{
+    close();
+
+    remote_.connect(endpoint);
+    Remote = &remote_;
+
+    // A PCI device has at most 6 BARs.  Servers number their regions the way we do.
+    for (int region = 0; region < 6; ++region)
+    {
+        size_t size = remote_.regionSize(region);
+        if (size == 0) break;
+        resource_.push_back({nullptr, size, 0});
+    }
+
+    deviceDir_    = "";
+    haveLinkInfo_ = false;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// openSimulated() - Opens a stand-in for a device: a single region of anonymous memory
+//
+// This lets every mode (and the server) be exercised on a machine without the hardware
+//=================================================================================================
+void PciDevice::openSimulated(size_t size)
+{
+    close();
+
+    void* ptr = ::mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ptr == MAP_FAILED) throwRuntime("mmap failed for a simulated region of size 0x%lx", size);
+
+    resource_.push_back({(uint8_t*)ptr, size, 0});
+    deviceDir_    = "";
+    haveLinkInfo_ = false;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// Offsets and fields within PCI config space and the PCI Express capability structure
+//=================================================================================================
+static const int CFG_STATUS        = 0x06;
+static const int CFG_CAP_PTR       = 0x34;
+static const int STATUS_CAP_LIST   = 0x10;
+static const int CAP_ID_PCIE       = 0x10;
+
+static const int PCIE_DEVCAP       = 0x04;
+static const int PCIE_DEVCTL       = 0x08;
+static const int PCIE_LNKCAP       = 0x0C;
+static const int PCIE_LNKSTA       = 0x12;
+
+static const int DEVCTL_RELAX_EN   = 0x0010;
+static const int DEVCTL_NOSNOOP_EN = 0x0800;
+//=================================================================================================
+
+
+//=================================================================================================
+// readLinkInfo() - Reads the device's config space from sysfs and walks the capability list
+//                  to find the PCI Express capability
+//
+// Notes: Unprivileged users can only read the first 64 bytes of config space, which doesn't
+//        include any capabilities.  In that case, 'isPcie' comes back false.
+//
+//        A simulated or remote device has no sysfs directory, so there's nothing to read.
+//=================================================================================================
+PciDevice::linkInfo_t PciDevice::readLinkInfo()
+{
+    linkInfo_t      info;
+    vector<uint8_t> config(4096);
+
+    if (deviceDir_.empty())
+    {
+        info.absent = isRemote() ? "remote" : "simulated";
+        return info;
+    }
+
+    // Read as much of config space as the kernel will give us
+    FileDes fd = ::open(c(deviceDir_ + "/config"), O_RDONLY);
+    if (fd < 0) return info;
+    ssize_t length = ::read(fd, config.data(), config.size());
+    if (length < 64) return info;
+    config.resize(length);
+    info.valid = true;
+
+    // Little-endian accessors that won't read past what we have
+    auto u8  = [&](size_t offset) -> uint32_t {return offset < config.size() ? config[offset] : 0;};
+    auto u16 = [&](size_t offset) -> uint32_t {return u8(offset) | (u8(offset + 1) << 8);};
+    auto u32 = [&](size_t offset) -> uint32_t {return u16(offset) | (u16(offset + 2) << 16);};
+
+    // If the device has no capability list, it can't be PCI Express
+    if ((u16(CFG_STATUS) & STATUS_CAP_LIST) == 0) return info;
+
+    // Walk the capability list looking for the PCI Express capability.  The count guards
+    // against a malformed list that loops back on itself.
+    uint32_t cap = u8(CFG_CAP_PTR) & 0xFC;
+    for (int count = 0; cap && count < 48; ++count)
+    {
+        if (u8(cap) == CAP_ID_PCIE) break;
+        cap = u8(cap + 1) & 0xFC;
+    }
+
+    if (cap == 0 || cap + PCIE_LNKSTA + 2 > config.size()) return info;
+
+    uint32_t devcap = u32(cap + PCIE_DEVCAP);
+    uint32_t devctl = u16(cap + PCIE_DEVCTL);
+    uint32_t lnkcap = u32(cap + PCIE_LNKCAP);
+    uint32_t lnksta = u16(cap + PCIE_LNKSTA);
+
+    info.isPcie          = true;
+    info.maxMps          = 128 << (devcap & 7);
+    info.mps             = 128 << ((devctl >> 5) & 7);
+    info.mrrs            = 128 << ((devctl >> 12) & 7);
+    info.relaxedOrdering = (devctl & DEVCTL_RELAX_EN) != 0;
+    info.noSnoop         = (devctl & DEVCTL_NOSNOOP_EN) != 0;
+    info.maxSpeed        = lnkcap & 0xF;
+    info.maxWidth        = (lnkcap >> 4) & 0x3F;
+    info.speed           = lnksta & 0xF;
+    info.width           = (lnksta >> 4) & 0x3F;
+
+    return info;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// linkInfo() - Returns the (cached) link information for the open device
+//=================================================================================================
+const PciDevice::linkInfo_t& PciDevice::linkInfo()
+{
+    if (!haveLinkInfo_)
+    {
+        linkInfo_     = readLinkInfo();
+        haveLinkInfo_ = true;
+    }
+
+    return linkInfo_;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// speedName() - Returns the human-readable name of a PCIe link speed
+//=================================================================================================
+const char* PciDevice::speedName(int generation)
+{
+    static const char* name[] = {"unknown", "2.5 GT/s", "5 GT/s", "8 GT/s", "16 GT/s", "32 GT/s", "64 GT/s"};
+    return (generation > 0 && generation < 7) ? name[generation] : name[0];
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// bandwidth() - Returns the raw bandwidth of the link in one direction, in GB/s
+//
+// Gen1 and Gen2 use 8b/10b encoding, Gen3 through Gen5 use 128b/130b, and Gen6 uses FLIT mode
+// with 242 payload bytes per 256-byte FLIT
+//=================================================================================================
+double PciDevice::linkInfo_t::bandwidth() const
+{
+    static const double gtps[]     = {0, 2.5, 5, 8, 16, 32, 64};
+    static const double encoding[] = {0, 0.8, 0.8, 128/130.0, 128/130.0, 128/130.0, 242/256.0};
+    if (speed < 1 || speed > 6) return 0;
+    return gtps[speed] * encoding[speed] * width / 8;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// printLinkInfo() - Prints link information in human-readable form
+//=================================================================================================
+void PciDevice::printLinkInfo(FILE* file, const char* prefix, const linkInfo_t& info)
+{
+    if (info.absent)
+    {
+        fprintf(file, "%slink info not available for a %s device\n", prefix, info.absent);
+        return;
+    }
+
+    if (!info.valid)
+    {
+        fprintf(file, "%sconfig space is unreadable\n", prefix);
+        return;
+    }
+
+    if (!info.isPcie)
+    {
+        fprintf(file, "%sno PCI Express capability (or config space is restricted; try as root)\n", prefix);
+        return;
+    }
+
+    const char* speedNote = (info.speed < info.maxSpeed) ? "  (DOWNTRAINED)" : "";
+    const char* widthNote = (info.width < info.maxWidth) ? "  (DOWNTRAINED)" : "";
+
+    fprintf(file, "%slink speed       : %s (max %s)%s\n", prefix, speedName(info.speed),
+            speedName(info.maxSpeed), speedNote);
+    fprintf(file, "%slink width       : x%i (max x%i)%s\n", prefix, info.width, info.maxWidth, widthNote);
+    fprintf(file, "%slink bandwidth   : %.2f GB/s per direction\n", prefix, info.bandwidth());
+    fprintf(file, "%smax payload      : %i bytes (device supports %i)\n", prefix, info.mps, info.maxMps);
+    fprintf(file, "%smax read request : %i bytes\n", prefix, info.mrrs);
+    fprintf(file, "%srelaxed ordering : %s\n", prefix, info.relaxedOrdering ? "enabled" : "disabled");
+    fprintf(file, "%sno snoop         : %s\n", prefix, info.noSnoop ? "enabled" : "disabled");
+}
+//=================================================================================================
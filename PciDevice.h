@@ -2,8 +2,10 @@
 // PciDevice.h - Defines a generic class for mapping PCIe devices into user-space
 //=================================================================================================
 #pragma once
+#include <stdio.h>
 #include <string>
 #include <vector>
+#include "RemoteDevice.h"
 
 class PciDevice
 {
@@ -22,16 +24,57 @@ public:
     // These each describe a memory mapped resource from a PCI device
     struct resource_t {uint8_t* baseAddr; size_t size; off_t physAddr;};
 
+    // Describes the PCIe link and the transaction settings that limit MMIO throughput
+    struct linkInfo_t
+    {
+        bool    valid = false;              // True if config space could be read
+        const char* absent = nullptr;       // "simulated" or "remote" if there's no local device
+        bool    isPcie = false;             // True if the device has a PCI Express capability
+        int     speed = 0, maxSpeed = 0;    // Link speed, as a PCIe generation (1 = 2.5 GT/s)
+        int     width = 0, maxWidth = 0;    // Link width, in lanes
+        int     mps = 0, maxMps = 0;        // Max payload size, in bytes
+        int     mrrs = 0;                   // Max read request size, in bytes
+        bool    relaxedOrdering = false;
+        bool    noSnoop = false;
+
+        // Raw bandwidth of the link in one direction, in GB/s, after line encoding
+        double  bandwidth() const;
+    };
+
     // Opens a connection to a PCIe device
     void    open(int vendorID, int deviceID, std::string deviceDir = "");
     void    open(std::string device, std::string deviceDir = "");
 
+    // Opens a connection to the device served by a pcireg server at "unix:/path" or "host:port".
+    // The resources have no local address; RegAccess forwards every operation to the server.
+    void    openRemote(const std::string& endpoint);
+
+    // Opens a simulated device: a single region of ordinary memory, initially all zero
+    void    openSimulated(size_t size);
+
+    // True if the open device is on a remote server
+    bool    isRemote() const {return Remote == &remote_;}
+
     // Fetches the list of memory mappable resources
     std::vector<resource_t>& resourceList() {return resource_;}
     
     // Stop access to the PCI device
     void    close();
 
+    // Returns the sysfs directory of the open device
+    const std::string& deviceDir() const {return deviceDir_;}
+
+    // Returns the link information from the device's config space.  It's parsed the first
+    // time it's asked for and cached from then on.
+    const linkInfo_t& linkInfo();
+
+    // Prints link information in human-readable form, one line per item, each line starting
+    // with 'prefix'
+    static void printLinkInfo(FILE* file, const char* prefix, const linkInfo_t& info);
+
+    // Returns a human-readable link speed such as "8 GT/s"
+    static const char* speedName(int generation);
+
 protected:
 
     // Fetches the list of memory-mappable resources
@@ -40,6 +83,19 @@ protected:
     // Memory maps the resources whose definitions are in resource_
     void mapResources();
 
+    // Parses the device's config space
+    linkInfo_t readLinkInfo();
+
     // Contains one entry for each resource (i.e, BAR) that is configured in the PCI device
     std::vector<resource_t> resource_;
+
+    // The sysfs directory of the open device
+    std::string deviceDir_;
+
+    // The cached link information, valid if 'haveLinkInfo_' is true
+    linkInfo_t  linkInfo_;
+    bool        haveLinkInfo_ = false;
+
+    // The connection to the server, if the device is remote
+    RemoteDevice remote_;
 };
@@ -0,0 +1,172 @@
+//=================================================================================================
+// PerfCounters.cpp - Implements a group of hardware performance counters
+//=================================================================================================
+#include <unistd.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "PerfCounters.h"
+
+// The type and config that perf_event_open needs for each of our events
+static const struct {uint32_t type; uint64_t config; const char* name;} eventDef[] =
+{
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES,              "cycles"          },
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS,            "instructions"    },
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_STALLED_CYCLES_FRONTEND, "stalled-frontend"},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_STALLED_CYCLES_BACKEND,  "stalled-backend" },
+    {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES,        "context-switches"},
+};
+
+
+//=================================================================================================
+// operator+= - Accumulates another sample into this one
+//=================================================================================================
+PerfCounters::sample_t& PerfCounters::sample_t::operator+=(const sample_t& rhs)
+{
+    for (int i=0; i<EVENT_COUNT; ++i)
+    {
+        value[i] += rhs.value[i];
+        valid[i] |= rhs.valid[i];
+    }
+    scaled |= rhs.scaled;
+    return *this;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// open() - Opens one counter per event, all in the same group so they're scheduled together.
+//
+// Hosts (and especially virtual machines) frequently can't count some of these events.  Those
+// counters are simply left out of the group.
+//
+// The group is read in one go, along with how long it was enabled and how long it was actually
+// counting, so that stop() can tell when the kernel had to multiplex it.
+//=================================================================================================
+bool PerfCounters::open()
+{
+    close();
+
+    for (int i=0; i<EVENT_COUNT; ++i)
+    {
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof attr);
+        attr.size           = sizeof attr;
+        attr.type           = eventDef[i].type;
+        attr.config         = eventDef[i].config;
+        attr.disabled       = (leader_ == -1);
+        attr.exclude_kernel = 1;
+        attr.exclude_hv     = 1;
+        attr.read_format    = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED
+                            | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+        // Count this event for the calling thread on any CPU
+        fd_[i] = syscall(SYS_perf_event_open, &attr, 0, -1, leader_, 0);
+
+        // The first counter we manage to open becomes the group leader
+        if (fd_[i] >= 0 && leader_ == -1) leader_ = fd_[i];
+        if (fd_[i] >= 0) ++members_;
+    }
+
+    return leader_ != -1;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// close() - Closes all counters
+//=================================================================================================
+void PerfCounters::close()
+{
+    for (auto& fd : fd_)
+    {
+        if (fd >= 0) ::close(fd);
+        fd = -1;
+    }
+    leader_  = -1;
+    members_ = 0;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// start() - Zeroes the counters and starts them counting
+//=================================================================================================
+void PerfCounters::start()
+{
+    if (leader_ == -1) return;
+    ioctl(leader_, PERF_EVENT_IOC_RESET,  PERF_IOC_FLAG_GROUP);
+    ioctl(leader_, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// stop() - Stops the counters and returns their values
+//
+// The group reads as {count, time enabled, time running, value...}, with the values in the
+// order the counters joined the group.  If the group never got onto the PMU, there's nothing to
+// report.  If it was only on for part of the time, the values are scaled up to estimate the
+// whole, the way "perf stat" does it.
+//=================================================================================================
+PerfCounters::sample_t PerfCounters::stop()
+{
+    sample_t result;
+    uint64_t data[3 + EVENT_COUNT];
+
+    if (leader_ == -1) return result;
+
+    ioctl(leader_, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+
+    ssize_t expected = (3 + members_) * sizeof(uint64_t);
+    if (::read(leader_, data, sizeof data) != expected || data[0] != (uint64_t)members_) return result;
+
+    uint64_t enabled = data[1], running = data[2];
+    if (running == 0) return result;
+    result.scaled = (running < enabled);
+
+    const uint64_t* value = data + 3;
+    for (int i=0; i<EVENT_COUNT; ++i)
+    {
+        if (fd_[i] < 0) continue;
+        uint64_t v = *value++;
+        result.value[i] = result.scaled ? (uint64_t)((double)v * enabled / running) : v;
+        result.valid[i] = true;
+    }
+
+    return result;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// print() - Prints a sample on a single line, along with the per-access cost of each event
+//=================================================================================================
+void PerfCounters::print(FILE* ofile, const char* label, const sample_t& sample, uint64_t accesses)
+{
+    fprintf(ofile, "%s", label);
+
+    for (int i=0; i<EVENT_COUNT; ++i)
+    {
+        if (!sample.valid[i])
+            fprintf(ofile, " %s=n/a", eventDef[i].name);
+        else if (i == CONTEXT_SWITCHES || accesses == 0)
+            fprintf(ofile, " %s=%lu", eventDef[i].name, sample.value[i]);
+        else
+            fprintf(ofile, " %s=%lu (%.1f/access)", eventDef[i].name, sample.value[i],
+                    (double)sample.value[i] / accesses);
+    }
+
+    // Instructions-per-cycle is a good summary of how much the CPU sat stalled
+    if (sample.valid[CYCLES] && sample.valid[INSTRUCTIONS] && sample.value[CYCLES])
+    {
+        fprintf(ofile, " ipc=%.2f", (double)sample.value[INSTRUCTIONS] / sample.value[CYCLES]);
+    }
+
+    // Say so if the counts are estimates
+    if (sample.scaled) fprintf(ofile, " (multiplexed, scaled)");
+
+    fprintf(ofile, "\n");
+}
+//=================================================================================================
@@ -0,0 +1,65 @@
+//=================================================================================================
+// PerfCounters.h - Defines a group of hardware performance counters (via perf_event_open) that
+//                  can be wrapped around a loop of register accesses
+//=================================================================================================
+#pragma once
+#include <stdio.h>
+#include <stdint.h>
+
+class PerfCounters
+{
+public:
+
+    // These are the events we count
+    enum event_t {CYCLES, INSTRUCTIONS, STALLED_FRONTEND, STALLED_BACKEND, CONTEXT_SWITCHES,
+                  EVENT_COUNT};
+
+    // A set of counter values.  'valid' is false for events the host can't count, or couldn't
+    // count this time.  'scaled' is true if the kernel multiplexed the group, in which case the
+    // values are estimates, scaled up from the fraction of the time the group was counting.
+    struct sample_t
+    {
+        uint64_t value[EVENT_COUNT] = {};
+        bool     valid[EVENT_COUNT] = {};
+        bool     scaled = false;
+
+        // Accumulates another sample into this one
+        sample_t& operator+=(const sample_t& rhs);
+    };
+
+    // Default constructor
+    PerfCounters() {};
+
+    // Destructor
+    ~PerfCounters() {close();}
+
+    // No copy or assignment constructor - objects of this class can't be copied
+    PerfCounters (const PerfCounters&) = delete;
+    PerfCounters& operator= (const PerfCounters&) = delete;
+
+    // Opens the counter group for the calling thread.  Returns false if no counter could be opened
+    bool     open();
+
+    // Closes all counters
+    void     close();
+
+    // Zeroes the counters and starts them counting
+    void     start();
+
+    // Stops the counters and returns their values
+    sample_t stop();
+
+    // Prints a sample on a single line.  'accesses' is used to compute per-access costs
+    static void print(FILE* ofile, const char* label, const sample_t& sample, uint64_t accesses);
+
+protected:
+
+    // File descriptor for each counter, -1 if that counter isn't available
+    int fd_[EVENT_COUNT] = {-1, -1, -1, -1, -1};
+
+    // The number of counters in the group
+    int members_ = 0;
+
+    // The file descriptor of the group leader
+    int leader_ = -1;
+};
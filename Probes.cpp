@@ -0,0 +1,22 @@
+//=================================================================================================
+// Probes.cpp - Defines the semaphores for the USDT probes declared in Probes.h
+//
+// Tracers find each semaphore through the probe's note and increment it while attached, so the
+// semaphores must live in the ".probes" section.
+//=================================================================================================
+#include "Probes.h"
+
+#if defined(__x86_64__) && !defined(PCIREG_NO_PROBES)
+
+#define DEFINE_PROBE(name) \
+    volatile unsigned short pcireg_##name##_semaphore __attribute__((section(".probes"))) = 0
+
+DEFINE_PROBE(reg_read);
+DEFINE_PROBE(reg_write);
+DEFINE_PROBE(field_rmw);
+DEFINE_PROBE(wait_start);
+DEFINE_PROBE(wait_end);
+DEFINE_PROBE(device_open);
+DEFINE_PROBE(device_map);
+
+#endif
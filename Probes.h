@@ -0,0 +1,85 @@
+//=================================================================================================
+// Probes.h - USDT (user-level statically defined tracing) probes for tools such as bpftrace
+//
+// The probes are emitted in the same ELF ".note.stapsdt" format that <sys/sdt.h> produces, so
+// they can be listed with "bpftrace -l 'usdt:./pcireg:*'" and attached without rebuilding.  No
+// header or library from systemtap is needed.
+//
+// Each probe site compiles to a single NOP.  Every probe also has a semaphore that the tracer
+// increments while it is attached, and PROBE_ENABLED() tests it so that work done only to feed
+// a probe (such as timing an access) can be skipped when nobody is listening.
+//
+// Define PCIREG_NO_PROBES to compile the probes out entirely.
+//=================================================================================================
+#pragma once
+
+#if defined(__x86_64__) && !defined(PCIREG_NO_PROBES)
+
+// Declares the semaphore for a probe.  Probes.cpp defines them all.
+#define DECLARE_PROBE(name) extern volatile unsigned short pcireg_##name##_semaphore
+
+// True when a tracer is attached to the named probe
+#define PROBE_ENABLED(name) __builtin_expect(pcireg_##name##_semaphore != 0, 0)
+
+// Emits the NOP and the note that describes it.  'args' is the argument description string.
+#define _PCIREG_PROBE(name, args, ...)                                                          \
+    __asm__ __volatile__ (                                                                      \
+        "990: nop\n"                                                                            \
+        ".pushsection .note.stapsdt,\"?\",\"note\"\n"                                           \
+        ".balign 4\n"                                                                           \
+        ".4byte 992f-991f, 994f-993f, 3\n"                                                      \
+        "991: .asciz \"stapsdt\"\n"                                                             \
+        "992: .balign 4\n"                                                                      \
+        "993: .8byte 990b\n"                                                                    \
+        ".8byte _.stapsdt.base\n"                                                               \
+        ".8byte pcireg_" #name "_semaphore\n"                                                   \
+        ".asciz \"pcireg\"\n"                                                                   \
+        ".asciz \"" #name "\"\n"                                                                \
+        ".asciz \"" args "\"\n"                                                                 \
+        "994: .balign 4\n"                                                                      \
+        ".popsection\n"                                                                         \
+        ".ifndef _.stapsdt.base\n"                                                              \
+        ".pushsection .stapsdt.base,\"aG\",\"progbits\",.stapsdt.base,comdat\n"                 \
+        ".weak _.stapsdt.base\n"                                                                \
+        ".hidden _.stapsdt.base\n"                                                              \
+        "_.stapsdt.base: .space 1\n"                                                            \
+        ".size _.stapsdt.base, 1\n"                                                             \
+        ".popsection\n"                                                                         \
+        ".endif\n"                                                                              \
+        :: __VA_ARGS__)
+
+// Every argument is passed to the tracer as an unsigned 64-bit value
+#define _PCIREG_ARG(n, v) [a##n] "nor" ((unsigned long long)(v))
+
+#define PROBE2(name, a1, a2)                                                                    \
+    _PCIREG_PROBE(name, "8@%[a1] 8@%[a2]", _PCIREG_ARG(1, a1), _PCIREG_ARG(2, a2))
+
+#define PROBE3(name, a1, a2, a3)                                                                \
+    _PCIREG_PROBE(name, "8@%[a1] 8@%[a2] 8@%[a3]",                                              \
+                  _PCIREG_ARG(1, a1), _PCIREG_ARG(2, a2), _PCIREG_ARG(3, a3))
+
+#define PROBE4(name, a1, a2, a3, a4)                                                            \
+    _PCIREG_PROBE(name, "8@%[a1] 8@%[a2] 8@%[a3] 8@%[a4]",                                      \
+                  _PCIREG_ARG(1, a1), _PCIREG_ARG(2, a2), _PCIREG_ARG(3, a3), _PCIREG_ARG(4, a4))
+
+#else
+
+#define DECLARE_PROBE(name)              struct pcireg_##name##_unused
+#define PROBE_ENABLED(name)              0
+#define PROBE2(name, a1, a2)             do {} while (0)
+#define PROBE3(name, a1, a2, a3)         do {} while (0)
+#define PROBE4(name, a1, a2, a3, a4)     do {} while (0)
+
+#endif
+
+
+//=================================================================================================
+// These are the probes, and the arguments each one carries
+//=================================================================================================
+DECLARE_PROBE(reg_read);        // offset, value, latency_ns
+DECLARE_PROBE(reg_write);       // offset, value, latency_ns
+DECLARE_PROBE(field_rmw);       // offset, field_spec, old_value, new_value
+DECLARE_PROBE(wait_start);      // offset, field_spec, expected_value, timeout_ms
+DECLARE_PROBE(wait_end);        // offset, last_value, latency_ns, satisfied
+DECLARE_PROBE(device_open);     // vendor_id, device_id
+DECLARE_PROBE(device_map);      // bar_index, phys_addr, size, latency_ns
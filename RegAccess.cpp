@@ -0,0 +1,494 @@
+//=================================================================================================
+// RegAccess.cpp - Implements the routines that read and write registers in a memory-mapped
+//                 PCI region
+//
+// Every register access made by pcireg goes through these routines, so this is where optional
+// instrumentation is applied.  When instrumentation is disabled, each access pays for nothing
+// more than a test of a flag.
+//
+// It's also where operations are sent to a pcireg server when the device is remote.  Each of the
+// public routines hands the whole operation to the server, so that a field write or a wait costs
+// a single round trip rather than one per register access.
+//=================================================================================================
+#include <pthread.h>
+#include <sched.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "RegAccess.h"
+#include "RegStats.h"
+#include "Probes.h"
+#include "Journal.h"
+#include "RemoteDevice.h"
+
+
+//=================================================================================================
+// mmioRead() / mmioWrite() - Perform a single 32-bit access to the register at the specified
+//                            offset.  The access is timed only when statistics are enabled or
+//                            a tracer is attached to the corresponding probe.
+//
+// If the write journal is open, every write is recorded in it.  'oldValue' is the prior value
+// of the register if the caller happens to know it, or nullptr.
+//=================================================================================================
+static inline uint32_t mmioRead(uint8_t* base_addr, uint32_t axi_addr)
+{
+    volatile uint32_t* addr = (volatile uint32_t*)(base_addr + axi_addr);
+
+    // In the normal case, just read the register
+    if (!AccessStats.enabled() && !PROBE_ENABLED(reg_read)) return *addr;
+
+    // Otherwise, time the read
+    uint64_t start   = RegStats::now();
+    uint32_t value   = *addr;
+    uint64_t latency = RegStats::now() - start;
+
+    // And report it to whoever is interested
+    if (AccessStats.enabled()) AccessStats.record(axi_addr, RegStats::READ, latency);
+    PROBE3(reg_read, axi_addr, value, latency);
+    return value;
+}
+
+static inline void mmioWrite(uint8_t* base_addr, uint32_t axi_addr, uint32_t value,
+                             const uint32_t* oldValue = nullptr)
+{
+    volatile uint32_t* addr = (volatile uint32_t*)(base_addr + axi_addr);
+
+    // Journal the write
+    if (WriteJournal.isOpen())
+    {
+        WriteJournal.record(axi_addr, oldValue ? *oldValue : 0, oldValue != nullptr, value);
+    }
+
+    // In the normal case, just write the register
+    if (!AccessStats.enabled() && !PROBE_ENABLED(reg_write))
+    {
+        *addr = value;
+        return;
+    }
+
+    // Otherwise, time the write
+    uint64_t start   = RegStats::now();
+    *addr = value;
+    uint64_t latency = RegStats::now() - start;
+
+    // And report it to whoever is interested
+    if (AccessStats.enabled()) AccessStats.record(axi_addr, RegStats::WRITE, latency);
+    PROBE3(reg_write, axi_addr, value, latency);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// writeRegister- Writes either :
+//                  A single 32-bit value in a register
+//                         -- or --
+//                  A pair of 32-bit values into adjacent registers
+//=================================================================================================
+void writeRegister(uint8_t* base_addr, uint32_t axi_addr, uint64_t data, bool wide)
+{
+    if (Remote) return Remote->writeRegister(axi_addr, data, wide);
+
+    // If we're supposed to write the upper 32-bits to a register make it so
+    if (wide)
+    {
+        mmioWrite(base_addr, axi_addr, (uint32_t)(data >> 32));
+        axi_addr += 4;
+    }
+
+    // And write the lower 32-bits of the value into the register
+    mmioWrite(base_addr, axi_addr, (uint32_t)(data & 0xFFFFFFFF));
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// readRegister - Reads either :
+//                   A single 32-bit value in a register
+//                          -- or --
+//                   A pair of 32-bit values into adjacent registers
+//=================================================================================================
+uint64_t readRegister(uint8_t* base_addr, uint32_t axi_addr, bool wide)
+{
+    if (Remote) return Remote->readRegister(axi_addr, wide);
+
+    // If we're returning a 64-bit value, read both registers
+    if (wide)
+    {
+        uint64_t hi = mmioRead(base_addr, axi_addr);
+        uint64_t lo = mmioRead(base_addr, axi_addr + 4);
+        return (hi << 32) | lo;
+    }
+
+    // Otherwise, just return whatever is stored at the single 32-bit register
+    return mmioRead(base_addr, axi_addr);
+}
+//=================================================================================================
+
+
+
+//=================================================================================================
+// writeField - Writes a specific bit-field within a register
+//=================================================================================================
+void writeField(uint8_t* base_addr, uint32_t axi_addr, uint64_t data, uint32_t fieldSpec)
+{
+    if (Remote) return Remote->writeField(axi_addr, data, fieldSpec);
+
+    // Find the current value of the register
+    uint32_t currentValue = mmioRead(base_addr, axi_addr);
+
+    // Fetch the bit-field's width, and the position of the right-most bit
+    uint32_t width = (fieldSpec >> 24) & 0xFF;
+    uint32_t pos   = (fieldSpec >> 16) & 0xFF;
+
+    // This is all 1's in the right-most 'width' bits
+    uint32_t mask = (width >= 32) ? 0xFFFFFFFF : (1U << width) - 1;
+
+    // Mask off any invalid bits of the data we're going to write
+    uint32_t maskedData = (uint32_t)(data & mask);
+
+    // In the newValue, set all bits of this field to zero
+    uint32_t newValue = currentValue & ~(mask << pos);
+
+    // Stamp the data value into the bit-field
+    newValue |= (maskedData << pos);
+
+    // And store the new value into the register
+    mmioWrite(base_addr, axi_addr, newValue, &currentValue);
+    PROBE4(field_rmw, axi_addr, fieldSpec, currentValue, newValue);
+}
+//=================================================================================================
+
+
+
+//=================================================================================================
+// readField - Reads a specific bit-field within a register
+//=================================================================================================
+uint64_t readField(uint8_t* base_addr, uint32_t axi_addr, uint32_t fieldSpec)
+{
+    if (Remote) return Remote->readField(axi_addr, fieldSpec);
+
+    // Find the current value of the register
+    uint32_t currentValue = mmioRead(base_addr, axi_addr);
+
+    // Fetch the bit-field's width, and the position of the right-most bit
+    uint32_t width = (fieldSpec >> 24) & 0xFF;
+    uint32_t pos   = (fieldSpec >> 16) & 0xFF;
+
+    // This is all 1's in the right-most 'width' bits
+    uint32_t mask = (width >= 32) ? 0xFFFFFFFF : (1U << width) - 1;
+
+    // Hand the caller the value of this bit-field
+    return (currentValue >> pos) & mask;
+}
+//=================================================================================================
+
+
+
+//=================================================================================================
+// waitRegister - Polls a register (or a bit-field within one) until it holds the specified value
+//
+// Passed:  fieldSpec = the field to poll, or 0 to poll the entire register
+//          wide      = true if a whole-register poll should read a pair of registers
+//          value     = the value we're waiting for
+//          timeoutMs = the maximum number of milliseconds to wait
+//
+// Returns: true if the value was seen, false if we timed out.  If 'lastValue' isn't null, it
+//          receives the final value that was read.
+//=================================================================================================
+bool waitRegister(uint8_t* base_addr, uint32_t axi_addr, uint32_t fieldSpec, bool wide,
+                  uint64_t value, uint32_t timeoutMs, uint64_t* lastValue)
+{
+    uint64_t current;
+
+    // A remote wait polls on the server
+    if (Remote) return Remote->waitRegister(axi_addr, fieldSpec, wide, value, timeoutMs, lastValue);
+
+    PROBE4(wait_start, axi_addr, fieldSpec, value, timeoutMs);
+
+    // Figure out when we give up
+    uint64_t startTime = RegStats::now();
+    uint64_t deadline  = startTime + timeoutMs * 1000000ULL;
+
+    while (true)
+    {
+        // Fetch the current value of the register or field
+        if (fieldSpec == 0)
+            current = readRegister(base_addr, axi_addr, wide);
+        else
+            current = readField(base_addr, axi_addr, fieldSpec);
+
+        // If it's the value we're waiting for, or we're out of time, we're done
+        if (current == value || RegStats::now() >= deadline) break;
+    }
+
+    // Timing the wait for the tracer's benefit costs a clock read, so only do it for a tracer
+    if (PROBE_ENABLED(wait_end))
+    {
+        PROBE4(wait_end, axi_addr, current, RegStats::now() - startTime, current == value);
+    }
+
+    // Hand the caller the last value we saw
+    if (lastValue) *lastValue = current;
+    return current == value;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// ReadPool - A set of worker threads, each pinned to a CPU of its own, that read slices of a list
+//            of registers alongside the calling thread
+//
+// The workers are started the first time they're needed and live until the process exits, so
+// a snapshot pays for waking them rather than for creating and joining threads.  The calling
+// thread is pinned to a CPU that no worker uses for as long as it's reading, and then let go.
+//=================================================================================================
+class ReadPool
+{
+public:
+
+    // Destructor - stops the workers
+    ~ReadPool() {resize(0);}
+
+    // Reads 'count' registers into 'value', spread across 'threads' threads
+    void    read(uint8_t* base_addr, const uint32_t* axi_addr, uint32_t* value, size_t count,
+                 int threads);
+
+protected:
+
+    // Stops the workers and starts 'workers' new ones
+    void    resize(size_t workers);
+
+    // The body of worker 'index', which starts with the jobs after 'generation'
+    void    worker(size_t index, int cpu, uint64_t generation);
+
+    // Reads slice 'slice' of the current job
+    void    readSlice(size_t slice);
+
+    // Held for the whole of a read(), so that only one caller at a time uses the workers
+    std::mutex               busy_;
+
+    // Protects everything below
+    std::mutex               mutex_;
+    std::condition_variable  start_, done_;
+    std::vector<std::thread> thread_;
+    uint64_t                 generation_ = 0;
+    size_t                   pending_ = 0;
+    bool                     stop_ = false;
+
+    // The CPU the calling thread reads its slice on, or -1 if we don't know which we may use
+    int                      callerCpu_ = -1;
+
+    // The current job
+    uint8_t*                 base_;
+    const uint32_t*          addr_;
+    uint32_t*                value_;
+    size_t                   count_, slices_;
+};
+
+static ReadPool Pool;
+//=================================================================================================
+
+
+//=================================================================================================
+// ReadPool::resize() - Stops the workers we have, and starts 'workers' new ones pinned to the
+//                      CPUs we're allowed to run on, in turn
+//=================================================================================================
+void ReadPool::resize(size_t workers)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    start_.notify_all();
+    for (auto& thread : thread_) thread.join();
+    thread_.clear();
+    stop_      = false;
+    callerCpu_ = -1;
+
+    if (workers == 0) return;
+
+    cpu_set_t allowed;
+    std::vector<int> cpu;
+    CPU_ZERO(&allowed);
+    sched_getaffinity(0, sizeof(allowed), &allowed);
+    for (int c=0; c<CPU_SETSIZE; ++c) if (CPU_ISSET(c, &allowed)) cpu.push_back(c);
+
+    // The calling thread reads the first slice on the first CPU, so the workers start with
+    // the next one
+    if (!cpu.empty()) callerCpu_ = cpu[0];
+    for (size_t w=0; w<workers; ++w)
+    {
+        int mine = cpu.empty() ? -1 : cpu[(w + 1) % cpu.size()];
+        thread_.emplace_back(&ReadPool::worker, this, w, mine, generation_);
+    }
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// ReadPool::worker() - Waits for jobs and reads worker 'index's slice of each one
+//
+// The generation to start after is handed in, rather than read here, so that a job posted
+// before the thread gets going isn't missed.
+//=================================================================================================
+void ReadPool::worker(size_t index, int cpu, uint64_t generation)
+{
+    if (cpu >= 0)
+    {
+        cpu_set_t mine;
+        CPU_ZERO(&mine);
+        CPU_SET(cpu, &mine);
+        pthread_setaffinity_np(pthread_self(), sizeof(mine), &mine);
+    }
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    uint64_t                     seen = generation;
+
+    while (true)
+    {
+        start_.wait(lock, [&] {return stop_ || generation_ != seen;});
+        if (stop_) return;
+        seen = generation_;
+
+        // Slice 0 belongs to the calling thread
+        lock.unlock();
+        if (index + 1 < slices_) readSlice(index + 1);
+        lock.lock();
+
+        if (--pending_ == 0) done_.notify_one();
+    }
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// ReadPool::readSlice() - Reads one contiguous slice of the current job
+//=================================================================================================
+void ReadPool::readSlice(size_t slice)
+{
+    size_t begin = count_ *  slice      / slices_;
+    size_t end   = count_ * (slice + 1) / slices_;
+    for (size_t i = begin; i < end; ++i) value_[i] = mmioRead(base_, addr_[i]);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// ReadPool::read() - Reads a list of registers, with the calling thread and the workers each
+//                    reading a contiguous slice of it
+//
+// The calling thread is pinned to its own CPU while it reads, so that it doesn't end up sharing
+// one with a worker.  Its own affinity is restored afterwards.
+//=================================================================================================
+void ReadPool::read(uint8_t* base_addr, const uint32_t* axi_addr, uint32_t* value, size_t count,
+                    int threads)
+{
+    std::lock_guard<std::mutex> busy(busy_);
+
+    if (thread_.size() != (size_t)threads - 1) resize(threads - 1);
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        base_    = base_addr;
+        addr_    = axi_addr;
+        value_   = value;
+        count_   = count;
+        slices_  = std::min(count, (size_t)threads);
+        pending_ = thread_.size();
+        ++generation_;
+    }
+    start_.notify_all();
+
+    cpu_set_t saved;
+    bool      pinned = callerCpu_ >= 0
+                    && pthread_getaffinity_np(pthread_self(), sizeof(saved), &saved) == 0;
+    if (pinned)
+    {
+        cpu_set_t mine;
+        CPU_ZERO(&mine);
+        CPU_SET(callerCpu_, &mine);
+        pthread_setaffinity_np(pthread_self(), sizeof(mine), &mine);
+    }
+
+    readSlice(0);
+
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        done_.wait(lock, [&] {return pending_ == 0;});
+    }
+
+    if (pinned) pthread_setaffinity_np(pthread_self(), sizeof(saved), &saved);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// readRegisters() - Reads a list of 32-bit registers, overlapping the reads where it's safe to
+//
+// An uncached MMIO read stalls its CPU until the completion comes back across the link, so a
+// single thread can only ever have one read in flight.  Spreading the reads across threads on
+// different CPUs lets several be outstanding at once.
+//
+// The list is read in order.  Only a run of consecutive registers that are all safe to read in
+// parallel is handed to the thread pool, and the run is finished before the register after it
+// is read, so a register with read side effects is never reordered with respect to any other.
+//
+// Passed: axi_addr = the addresses of the registers to read
+//         parallel = for each register, true if it may be read out of order (i.e., reading it
+//                    has no side effects)
+//         threads  = the number of threads to spread the parallel reads across
+//         value    = receives one value per register, in the same order as 'axi_addr'
+//=================================================================================================
+void readRegisters(uint8_t* base_addr, const std::vector<uint32_t>& axi_addr,
+                   const std::vector<bool>& parallel, int threads, uint32_t* value)
+{
+    // A remote list is sent as one pipelined batch
+    if (Remote) return Remote->readRegisters(axi_addr, value);
+
+    size_t count = axi_addr.size();
+
+    for (size_t i=0; i<count;)
+    {
+        // Find the run of parallel-safe registers that starts here
+        size_t end = i;
+        if (threads > 1) while (end < count && parallel[end]) ++end;
+
+        // A run of two or more is worth spreading across the pool
+        if (end - i > 1)
+        {
+            Pool.read(base_addr, &axi_addr[i], value + i, end - i, threads);
+            i = end;
+        }
+
+        // Anything else is read right here
+        else
+        {
+            value[i] = mmioRead(base_addr, axi_addr[i]);
+            ++i;
+        }
+    }
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// readRuns() - Reads a list of runs of adjacent registers
+//
+// Each run is read front to back in a tight loop.  When the device is remote, every register of
+// every run goes to the server as a single pipelined batch.
+//=================================================================================================
+void readRuns(uint8_t* base_addr, const std::vector<regRun_t>& runs, uint32_t* value)
+{
+    if (Remote)
+    {
+        std::vector<uint32_t> addr;
+        for (auto& run : runs) for (uint32_t i=0; i<run.count; ++i) addr.push_back(run.axiAddr + 4*i);
+        return Remote->readRegisters(addr, value);
+    }
+
+    for (auto& run : runs)
+    {
+        for (uint32_t i=0; i<run.count; ++i) *value++ = mmioRead(base_addr, run.axiAddr + 4*i);
+    }
+}
+//=================================================================================================
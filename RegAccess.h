@@ -0,0 +1,34 @@
+//=================================================================================================
+// RegAccess.h - Defines the routines that read and write registers in a memory-mapped PCI region
+//=================================================================================================
+#pragma once
+#include <stdint.h>
+#include <vector>
+
+// Writes/reads a 32-bit register, or a pair of adjacent 32-bit registers when 'wide' is true
+void     writeRegister(uint8_t* base_addr, uint32_t axi_addr, uint64_t data, bool wide);
+uint64_t readRegister (uint8_t* base_addr, uint32_t axi_addr,                bool wide);
+
+// Writes/reads a bit-field within a 32-bit register
+void     writeField   (uint8_t* base_addr, uint32_t axi_addr, uint64_t data, uint32_t fieldSpec);
+uint64_t readField    (uint8_t* base_addr, uint32_t axi_addr,                uint32_t fieldSpec);
+
+// Polls a register or bit-field until it holds 'value' or 'timeoutMs' milliseconds elapse
+bool     waitRegister (uint8_t* base_addr, uint32_t axi_addr, uint32_t fieldSpec, bool wide,
+                       uint64_t value, uint32_t timeoutMs, uint64_t* lastValue = nullptr);
+
+// Reads a list of 32-bit registers into 'value', in order.  Each run of consecutive registers
+// flagged in 'parallel' is spread across 'threads' threads pinned to separate CPUs, so that
+// several reads are in flight at once.  The rest are read one at a time on the calling thread.
+void     readRegisters(uint8_t* base_addr, const std::vector<uint32_t>& axi_addr,
+                       const std::vector<bool>& parallel, int threads, uint32_t* value);
+
+// A run of 'count' adjacent 32-bit registers starting at 'axiAddr'
+struct regRun_t
+{
+    uint32_t axiAddr;
+    uint32_t count;
+};
+
+// Reads a list of runs of registers, in order, into 'value' (one entry per register)
+void     readRuns     (uint8_t* base_addr, const std::vector<regRun_t>& runs, uint32_t* value);
@@ -0,0 +1,378 @@
+//=================================================================================================
+// RegStats.cpp - Implements optional per-register access counters and latency histograms
+//=================================================================================================
+#include <string.h>
+#include <algorithm>
+#include "RegStats.h"
+using namespace std;
+
+// This is the instance that the register access routines record into
+RegStats AccessStats;
+
+
+//=================================================================================================
+// reset() - Empties the histogram
+//=================================================================================================
+void LatencyHistogram::reset()
+{
+    memset(bucket_, 0, sizeof bucket_);
+    count_ = sum_ = max_ = 0;
+    min_   = UINT64_MAX;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// bucketIndex() - Returns the index of the bucket that 'value' is counted in
+//
+// Values 0 thru 31 each have their own bucket.  For larger values, 'shift' is chosen so that
+// (value >> shift) is in the range 16 thru 31, and that becomes the sub-bucket number.
+//=================================================================================================
+int LatencyHistogram::bucketIndex(uint64_t value)
+{
+    if (value < 32) return (int)value;
+
+    // Find the position of the most significant set bit (5 thru 63)
+    int msb = 63 - __builtin_clzll(value);
+
+    // This is how far the value must be shifted to leave 5 significant bits
+    int shift = msb - 4;
+
+    // Hand the caller the bucket number
+    return 32 + (shift - 1) * 16 + (int)((value >> shift) - 16);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// bucketLimit() - Returns the largest value that is counted in the specified bucket
+//=================================================================================================
+uint64_t LatencyHistogram::bucketLimit(int index)
+{
+    if (index < 32) return index;
+
+    int      shift = (index - 32) / 16 + 1;
+    uint64_t sub   = (index - 32) % 16 + 16;
+
+    return ((sub + 1) << shift) - 1;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// record() - Counts a value 'count' times
+//=================================================================================================
+void LatencyHistogram::record(uint64_t value, uint64_t count)
+{
+    bucket_[bucketIndex(value)] += count;
+    count_ += count;
+    sum_   += value * count;
+    if (value < min_) min_ = value;
+    if (value > max_) max_ = value;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// merge() - Adds the counts of another histogram into this one
+//=================================================================================================
+void LatencyHistogram::merge(const LatencyHistogram& other)
+{
+    for (int i=0; i<BUCKETS; ++i) bucket_[i] += other.bucket_[i];
+    count_ += other.count_;
+    sum_   += other.sum_;
+    if (other.min_ < min_) min_ = other.min_;
+    if (other.max_ > max_) max_ = other.max_;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// load() - Replaces the contents with buckets copied from a histogram with the same layout
+//=================================================================================================
+void LatencyHistogram::load(const uint64_t* bucket, int buckets, uint64_t sum, uint64_t min,
+                            uint64_t max)
+{
+    reset();
+    for (int i=0; i<buckets && i<BUCKETS; ++i)
+    {
+        bucket_[i] = bucket[i];
+        count_    += bucket[i];
+    }
+    sum_ = sum;
+    min_ = count_ ? min : UINT64_MAX;
+    max_ = max;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// percentile() - Returns the value at the specified percentile.  Because values are bucketed,
+//                this is the upper bound of the bucket the percentile falls in, clamped to the
+//                largest value ever recorded.
+//=================================================================================================
+uint64_t LatencyHistogram::percentile(double pct) const
+{
+    if (count_ == 0) return 0;
+
+    // This is how many values must be at or below the result
+    uint64_t target = (uint64_t)(pct / 100.0 * count_ + 0.5);
+    if (target < 1) target = 1;
+
+    // Walk the buckets until we've accumulated that many values
+    uint64_t seen = 0;
+    for (int i=0; i<BUCKETS; ++i)
+    {
+        seen += bucket_[i];
+        if (seen >= target) return std::min(bucketLimit(i), max_);
+    }
+
+    // We only get here through rounding
+    return max_;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// ~threadTable_t() - Frees a table's blocks of slots
+//=================================================================================================
+RegStats::threadTable_t::~threadTable_t()
+{
+    for (auto& b : block) delete[] b.load(memory_order_relaxed);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// at() - Returns the slot at a position in the blocks.  Block k starts at FIRST_BLOCK * (2^k - 1).
+//=================================================================================================
+RegStats::slot_t* RegStats::threadTable_t::at(size_t i) const
+{
+    int    k      = 63 - __builtin_clzll(i / FIRST_BLOCK + 1);
+    size_t offset = i - FIRST_BLOCK * ((1ULL << k) - 1);
+    return block[k].load(memory_order_acquire) + offset;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// find() - Returns the calling thread's slot for a register, creating it if necessary
+//
+// The index is open-addressed and kept at most half full.  Loops that hit the same register
+// over and over don't even get that far.
+//=================================================================================================
+RegStats::slot_t* RegStats::threadTable_t::find(uint32_t axiAddr)
+{
+    if (last && last->axiAddr == axiAddr) return last;
+
+    // Look the register up
+    size_t mask = index.size() - 1;
+    size_t h    = index.empty() ? 0 : ((axiAddr >> 2) * 0x9E3779B1U) & mask;
+    if (!index.empty())
+    {
+        for (; index[h]; h = (h + 1) & mask)
+        {
+            if (index[h]->axiAddr == axiAddr) return last = index[h];
+        }
+    }
+
+    // It's new.  Find room for it in the blocks, adding a block if need be.
+    size_t n = used.load(memory_order_relaxed);
+    int    k = 63 - __builtin_clzll(n / FIRST_BLOCK + 1);
+    if (k >= MAX_BLOCKS) return nullptr;
+    if (block[k].load(memory_order_relaxed) == nullptr)
+    {
+        block[k].store(new slot_t[FIRST_BLOCK << k](), memory_order_release);
+    }
+
+    slot_t* slot = at(n);
+    slot->axiAddr = axiAddr;
+    used.store(n + 1, memory_order_release);
+
+    // Index it, doubling the index first if it would be more than half full
+    if (2 * (indexed + 1) > index.size())
+    {
+        vector<slot_t*> old;
+        old.swap(index);
+        index.assign(max((size_t)64, old.size() * 2), nullptr);
+        indexed = 0;
+        mask    = index.size() - 1;
+        for (auto p : old)
+        {
+            if (p == nullptr) continue;
+            for (h = ((p->axiAddr >> 2) * 0x9E3779B1U) & mask; index[h]; h = (h + 1) & mask);
+            index[h] = p;
+            ++indexed;
+        }
+    }
+
+    for (h = ((axiAddr >> 2) * 0x9E3779B1U) & mask; index[h]; h = (h + 1) & mask);
+    index[h] = slot;
+    ++indexed;
+
+    return last = slot;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// myTable() - Returns the statistics table that belongs to the calling thread.
+//
+// There is only ever one RegStats instance, so a single thread-local pointer suffices.
+//=================================================================================================
+RegStats::threadTable_t& RegStats::myTable()
+{
+    static thread_local threadTable_t* table = nullptr;
+
+    // If this thread doesn't have a table yet, create one and add it to the list
+    if (table == nullptr)
+    {
+        lock_guard<mutex> lock(tablesMutex_);
+        tables_.push_back(make_unique<threadTable_t>());
+        table = tables_.back().get();
+    }
+
+    return *table;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// record() - Records a single access to a register
+//
+// Only this thread writes to its table, so each counter is updated with a plain load and store.
+// They're atomic only so that summarize() may read them while we write.
+//=================================================================================================
+void RegStats::record(uint32_t axiAddr, access_t access, uint64_t ns)
+{
+    slot_t* slot = myTable().find(axiAddr);
+    if (slot == nullptr) return;
+
+    latency_t& l     = slot->access[access];
+    uint32_t   value = (ns > UINT32_MAX) ? UINT32_MAX : (uint32_t)ns;
+    uint64_t   count = l.count.load(memory_order_relaxed);
+    auto&      b     = l.bucket[LatencyHistogram::bucketIndex(value)];
+
+    b.store(b.load(memory_order_relaxed) + 1, memory_order_relaxed);
+    l.sum.store(l.sum.load(memory_order_relaxed) + value, memory_order_relaxed);
+    if (count == 0 || value < l.min.load(memory_order_relaxed)) l.min.store(value, memory_order_relaxed);
+    if (value > l.max.load(memory_order_relaxed)) l.max.store(value, memory_order_relaxed);
+    l.count.store(count + 1, memory_order_relaxed);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// summarize() - Merges the tables of every thread and returns one entry per register
+//
+// The tables are read while their threads may still be writing to them, so a register's
+// counters may be a few accesses apart from one another.
+//=================================================================================================
+vector<RegStats::summary_t> RegStats::summarize()
+{
+    map<uint32_t, summary_t> merged;
+    uint64_t                 bucket[BUCKETS];
+
+    lock_guard<mutex> lock(tablesMutex_);
+
+    // Loop through the table of every thread that has recorded anything...
+    for (auto& table : tables_)
+    {
+        size_t used = table->used.load(memory_order_acquire);
+
+        // Fold each register's counters into the merged result
+        for (size_t i=0; i<used; ++i)
+        {
+            const slot_t& slot = *table->at(i);
+
+            auto it = merged.find(slot.axiAddr);
+            if (it == merged.end())
+            {
+                it = merged.emplace(slot.axiAddr, summary_t()).first;
+                it->second.axiAddr = slot.axiAddr;
+            }
+            summary_t& s = it->second;
+
+            for (int a=READ; a<=WRITE; ++a)
+            {
+                const latency_t& l = slot.access[a];
+                for (int b=0; b<BUCKETS; ++b) bucket[b] = l.bucket[b].load(memory_order_relaxed);
+
+                LatencyHistogram h;
+                h.load(bucket, BUCKETS, l.sum.load(memory_order_relaxed),
+                       l.min.load(memory_order_relaxed), l.max.load(memory_order_relaxed));
+
+                if (a == READ)
+                {
+                    s.reads += h.count();
+                    s.readLatency.merge(h);
+                }
+                else
+                {
+                    s.writes += h.count();
+                    s.writeLatency.merge(h);
+                }
+            }
+        }
+    }
+
+    // Hand the caller the merged results in address order
+    vector<summary_t> result;
+    for (auto& entry : merged) result.push_back(entry.second);
+    return result;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// reset() - Discards everything recorded so far
+//=================================================================================================
+void RegStats::reset()
+{
+    lock_guard<mutex> lock(tablesMutex_);
+
+    for (auto& table : tables_)
+    {
+        size_t used = table->used.load(memory_order_acquire);
+        for (size_t i=0; i<used; ++i)
+        {
+            for (auto& l : table->at(i)->access)
+            {
+                l.count.store(0, memory_order_relaxed);
+                l.sum.store(0, memory_order_relaxed);
+                l.min.store(0, memory_order_relaxed);
+                l.max.store(0, memory_order_relaxed);
+                for (auto& b : l.bucket) b.store(0, memory_order_relaxed);
+            }
+        }
+    }
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// report() - Prints a table of the merged statistics, one line per register.  Latencies are
+//            in nanoseconds.
+//=================================================================================================
+void RegStats::report(FILE* ofile, const map<uint32_t, string>& names)
+{
+    auto summary = summarize();
+
+    fprintf(ofile, "%-10s %10s %10s %8s %8s %8s %8s %8s %8s  %s\n",
+            "address", "reads", "writes", "rd_p50", "rd_p99", "rd_max",
+            "wr_p50", "wr_p99", "wr_max", "name");
+
+    for (auto& s : summary)
+    {
+        // Find the name of this register, if we know it
+        auto it = names.find(s.axiAddr);
+        const char* name = (it == names.end()) ? "" : it->second.c_str();
+
+        fprintf(ofile, "0x%08X %10lu %10lu %8lu %8lu %8lu %8lu %8lu %8lu  %s\n",
+                s.axiAddr, s.reads, s.writes,
+                s.readLatency.percentile(50),  s.readLatency.percentile(99),  s.readLatency.max(),
+                s.writeLatency.percentile(50), s.writeLatency.percentile(99), s.writeLatency.max(),
+                name);
+    }
+}
+//=================================================================================================
@@ -0,0 +1,181 @@
+//=================================================================================================
+// RegStats.h - Defines optional per-register access counters and latency histograms
+//=================================================================================================
+#pragma once
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+
+//=================================================================================================
+// LatencyHistogram - An HDR-style (log-linear) histogram of latencies in nanoseconds.
+//
+// Values below 32 are counted exactly.  Above that, each power-of-two range is split into
+// 16 linear sub-buckets, which gives about 6% precision over the full 64-bit range.
+//=================================================================================================
+class LatencyHistogram
+{
+public:
+
+    // Starts out empty
+    LatencyHistogram() {reset();}
+
+    // Empties the histogram
+    void     reset();
+
+    // Counts a value 'count' times
+    void     record(uint64_t value, uint64_t count = 1);
+
+    // Adds the counts of another histogram into this one
+    void     merge(const LatencyHistogram& other);
+
+    // Replaces the contents with the first 'buckets' buckets of a histogram with the same
+    // layout, and the exact sum, minimum and maximum of the values counted in them
+    void     load(const uint64_t* bucket, int buckets, uint64_t sum, uint64_t min, uint64_t max);
+
+    // Returns the (upper bound of the) value at the specified percentile (0 thru 100)
+    uint64_t percentile(double pct) const;
+
+    // Simple accessors
+    uint64_t count() const {return count_;}
+    uint64_t min()   const {return count_ ? min_ : 0;}
+    uint64_t max()   const {return max_;}
+    uint64_t mean()  const {return count_ ? sum_ / count_ : 0;}
+
+    // Number of buckets needed to cover the full 64-bit range
+    static const int BUCKETS = 32 + 59 * 16;
+
+    // Maps a value to a bucket index, and a bucket index to the highest value it holds
+    static int      bucketIndex(uint64_t value);
+    static uint64_t bucketLimit(int index);
+
+protected:
+
+    uint64_t bucket_[BUCKETS];
+    uint64_t count_, sum_, min_, max_;
+};
+//=================================================================================================
+
+
+
+//=================================================================================================
+// RegStats - Counts reads and writes per register address and records their latencies.
+//
+// Each thread records into its own table, so recording never contends with other threads and
+// takes no locks.  Only the owning thread writes to a table, with relaxed atomic stores, so
+// summarize() can merge the tables at any time.  When disabled, the cost to the register access
+// routines is a single relaxed load of a flag.
+//
+// Memory: every register a thread touches costs it one slot_t, about 3.7 KB, almost all of it
+// latency buckets.  Latencies are clamped to 2^32-1 ns (about 4 seconds), which keeps the
+// buckets to 32-bit counters covering 32 powers of two rather than 64.
+//=================================================================================================
+class RegStats
+{
+public:
+
+    // The kinds of access we keep track of
+    enum access_t {READ, WRITE};
+
+    // This is the merged result for a single register
+    struct summary_t
+    {
+        uint32_t         axiAddr = 0;
+        uint64_t         reads = 0, writes = 0;
+        LatencyHistogram readLatency, writeLatency;
+    };
+
+    // Turns instrumentation on or off
+    void    enable(bool flag) {enabled_.store(flag, std::memory_order_relaxed);}
+    bool    enabled() const   {return enabled_.load(std::memory_order_relaxed);}
+
+    // Returns a monotonic timestamp in nanoseconds
+    static uint64_t now()
+    {
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    }
+
+    // Records a single access to the register at 'axiAddr' that took 'ns' nanoseconds
+    void    record(uint32_t axiAddr, access_t access, uint64_t ns);
+
+    // Merges the per-thread tables and returns one entry per register, sorted by address
+    std::vector<summary_t> summarize();
+
+    // Discards everything recorded so far.  Accesses that are recorded while this runs may be
+    // partly kept.
+    void    reset();
+
+    // Prints a table of the merged statistics.  'names' maps addresses to register names
+    void    report(FILE* ofile, const std::map<uint32_t, std::string>& names = {});
+
+protected:
+
+    // The number of latency buckets kept per register: the exact ones and 16 sub-buckets for each
+    // power of two from 2^5 thru 2^31.  They're laid out like a LatencyHistogram's first buckets.
+    static const int BUCKETS = 32 + 27 * 16;
+
+    // One register's counters for one kind of access
+    struct latency_t
+    {
+        std::atomic<uint64_t> count, sum;
+        std::atomic<uint32_t> min, max;
+        std::atomic<uint32_t> bucket[BUCKETS];
+    };
+
+    // Everything one thread has recorded for a single register
+    struct slot_t
+    {
+        uint32_t  axiAddr;
+        latency_t access[2];
+    };
+
+    // A thread's slots live in blocks that never move: block k holds FIRST_BLOCK << k slots.
+    // A slot is filled in before 'used' counts it, so readers only look at complete slots.
+    static const size_t FIRST_BLOCK = 16;
+    static const int    MAX_BLOCKS  = 20;
+
+    // Each thread that records anything owns one of these
+    struct threadTable_t
+    {
+        std::atomic<slot_t*>  block[MAX_BLOCKS] = {};
+        std::atomic<size_t>   used{0};
+
+        // Finds slots by address.  Only the owning thread uses this, so it can grow freely.
+        std::vector<slot_t*>  index;
+        size_t                indexed = 0;
+        slot_t*               last = nullptr;
+
+        ~threadTable_t();
+
+        // Returns the slot at a position in the blocks
+        slot_t* at(size_t i) const;
+
+        // Returns the slot for a register, creating it if necessary.  Returns nullptr if the
+        // table is full.
+        slot_t* find(uint32_t axiAddr);
+    };
+
+    // Returns the table that belongs to the calling thread, creating it if necessary
+    threadTable_t& myTable();
+
+    // True when accesses should be recorded
+    std::atomic<bool> enabled_{false};
+
+    // Protects "tables_"
+    std::mutex tablesMutex_;
+
+    // One entry for every thread that has ever recorded an access
+    std::vector<std::unique_ptr<threadTable_t>> tables_;
+};
+//=================================================================================================
+
+// This is the instance that the register access routines record into
+extern RegStats AccessStats;
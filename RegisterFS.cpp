@@ -0,0 +1,570 @@
+//=================================================================================================
+// RegisterFS.cpp - Implements a FUSE filesystem that exposes registers and fields as files
+//
+// This speaks the FUSE kernel protocol directly over /dev/fuse, so there's no dependency on
+// libfuse.  Requests are served one at a time, in the order the kernel sends them.
+//
+// Every file is opened with FOPEN_DIRECT_IO so that the page cache is bypassed and every read
+// reaches the device.  The contents of a file are captured when it's read at offset 0, and
+// reads at later offsets are served from that capture so that a reader never sees a value
+// that's half from one read and half from another.
+//=================================================================================================
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/mount.h>
+#include <sys/uio.h>
+#include <linux/fuse.h>
+#include <stdexcept>
+#include "RegisterFS.h"
+#include "RegAccess.h"
+using namespace std;
+
+atomic<bool> RegisterFS::stopRequested_(false);
+
+// The largest write we'll accept.  Register values are tiny.
+static const uint32_t MAX_WRITE = 4096;
+
+// How long (in seconds) the kernel may cache names and attributes.  Contents are never cached.
+static const uint64_t CACHE_SECS = 1;
+
+
+//=================================================================================================
+// addNode() - Adds a node to the tree and returns its node ID.  If a node with the same parent
+//             and name has existed before, it's brought back to life with its old ID.
+//=================================================================================================
+uint64_t RegisterFS::addNode(uint64_t parent, const string& name, kind_t kind,
+                             uint32_t axiAddr, uint32_t fieldSpec)
+{
+    string   key = to_string(parent) + "/" + name;
+    uint64_t id;
+
+    auto it = nodeID_.find(key);
+    if (it != nodeID_.end())
+    {
+        id = it->second;
+        node_[id - 1] = {true, parent, name, kind, axiAddr, fieldSpec, {}, {}};
+    }
+    else
+    {
+        node_.push_back({true, parent, name, kind, axiAddr, fieldSpec, {}, {}});
+        id = node_.size();
+        nodeID_[key] = id;
+    }
+
+    if (parent)
+    {
+        node_[parent - 1].child.push_back(id);
+        node_[parent - 1].byName[name] = id;
+    }
+
+    return id;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// build() - Builds the directory tree from a symbol table
+//=================================================================================================
+void RegisterFS::build(const SymbolTable& symbols)
+{
+    map<string, uint64_t> block;
+
+    // Every node is dead until the new symbols say otherwise
+    for (auto& n : node_) n.live = false;
+    addNode(0, "", ROOT);
+
+    // Registers are visited in address order, so that's the order they appear in
+    for (auto& reg : symbols.registers())
+    {
+        uint32_t      addr = reg.first;
+        const string& name = reg.second;
+
+        // Registers outside of the region can't be read
+        if (addr >= regionSize_) continue;
+
+        // Find (or create) the directory for this register's block
+        string   blockName = name.substr(0, name.find('_'));
+        uint64_t blockID;
+        auto it = block.find(blockName);
+        if (it != block.end())
+            blockID = it->second;
+        else
+        {
+            blockID = addNode(1, blockName, BLOCK);
+            addNode(blockID, "snapshot", SNAPSHOT);
+            block[blockName] = blockID;
+        }
+
+        // Guard against a register with the same name as a block's snapshot file
+        if (node(blockID)->byName.count(name)) continue;
+
+        // Create the register's directory, its "value" file, and a file for each field
+        uint64_t regID = addNode(blockID, name, REGISTER, addr);
+        node(regID)->readSafe = symbols.isReadSafe(addr);
+        addNode(regID, "value", VALUE, addr);
+
+        for (auto& field : symbols.fields(addr))
+        {
+            if (node(regID)->byName.count(field.name)) continue;
+            uint32_t fieldSpec = (field.fieldSpec == 0x20000000) ? 0 : field.fieldSpec;
+            addNode(regID, field.name, FIELD, addr, fieldSpec);
+        }
+    }
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// mount() - Opens the FUSE device and mounts the filesystem on an existing directory
+//=================================================================================================
+void RegisterFS::mount(const string& mountPoint)
+{
+    char options[200];
+
+    fd_ = ::open("/dev/fuse", O_RDWR | O_CLOEXEC);
+    if (fd_ < 0) throw runtime_error("pcireg : cant open /dev/fuse");
+
+    // Other users (monitoring agents, etc) are allowed in, subject to the file permissions
+    sprintf(options, "fd=%i,rootmode=%o,user_id=%u,group_id=%u,allow_other,default_permissions",
+            fd_, S_IFDIR | 0555, getuid(), getgid());
+
+    if (::mount("pcireg", mountPoint.c_str(), "fuse.pcireg", MS_NOSUID | MS_NODEV, options) < 0)
+    {
+        ::close(fd_);
+        fd_ = -1;
+        throw runtime_error("pcireg : cant mount "+mountPoint+" : "+strerror(errno));
+    }
+
+    mountPoint_ = mountPoint;
+    mountTime_  = time(nullptr);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// unmount() - Unmounts the filesystem and closes the FUSE device
+//=================================================================================================
+void RegisterFS::unmount()
+{
+    if (!mountPoint_.empty()) umount2(mountPoint_.c_str(), MNT_DETACH);
+    if (fd_ >= 0) ::close(fd_);
+    mountPoint_.clear();
+    fd_ = -1;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// run() - Serves requests until the filesystem is unmounted or stop() is called
+//
+// stop() interrupts the read() of the FUSE device only if the signal handler that calls it was
+// installed without SA_RESTART
+//=================================================================================================
+void RegisterFS::run()
+{
+    // The kernel insists on a buffer big enough for the largest possible write
+    vector<uint8_t> buffer(MAX_WRITE + 64 * 1024);
+
+    while (!stopRequested_)
+    {
+        ssize_t length = read(fd_, buffer.data(), buffer.size());
+
+        if (length < 0)
+        {
+            // ENOENT means the request was interrupted before we got it
+            if (errno == EINTR || errno == ENOENT || errno == EAGAIN) continue;
+
+            // ENODEV means we've been unmounted
+            if (errno == ENODEV) break;
+
+            throw runtime_error(string("pcireg : error reading /dev/fuse : ")+strerror(errno));
+        }
+
+        if ((size_t)length < sizeof(fuse_in_header)) continue;
+
+        // If the symbol files have changed, rebuild the tree before answering
+        if (watcher_ && watcher_->generation() != generation_)
+        {
+            generation_ = watcher_->generation();
+            SymbolWatcher::Reader symbols(*watcher_);
+            build(*symbols);
+        }
+
+        ++requests_;
+        dispatch(buffer.data(), length);
+    }
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// reply() - Sends a reply to the kernel
+//
+// Passed: unique = the ID of the request we're replying to
+//         error  = 0, or a positive errno value
+//         data   = the body of the reply, if 'error' is 0
+//=================================================================================================
+void RegisterFS::reply(uint64_t unique, int error, const void* data, size_t length)
+{
+    fuse_out_header header;
+    struct iovec    iov[2];
+
+    if (error) length = 0;
+
+    header.len    = sizeof(header) + length;
+    header.error  = -error;
+    header.unique = unique;
+
+    iov[0].iov_base = &header;
+    iov[0].iov_len  = sizeof(header);
+    iov[1].iov_base = (void*)data;
+    iov[1].iov_len  = length;
+
+    // If the kernel no longer wants the reply (because the request was interrupted), that's fine
+    if (writev(fd_, iov, length ? 2 : 1) < 0 && errno != ENOENT)
+    {
+        fprintf(stderr, "pcireg : error writing /dev/fuse : %s\n", strerror(errno));
+    }
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// getAttr() - Fills in the attributes of a node
+//
+// Files report a size of 4096 (as sysfs does) since their contents aren't known until they're
+// read.  Snapshots are read-only, everything else that's a file may be written.
+//=================================================================================================
+void RegisterFS::getAttr(uint64_t id, fuse_attr* attr)
+{
+    const node_t& n = *node(id);
+
+    memset(attr, 0, sizeof(*attr));
+    attr->ino     = id;
+    attr->uid     = getuid();
+    attr->gid     = getgid();
+    attr->blksize = 4096;
+    attr->atime   = attr->mtime = attr->ctime = mountTime_;
+
+    switch (n.kind)
+    {
+        case ROOT:
+        case BLOCK:
+        case REGISTER:
+            attr->mode  = S_IFDIR | 0555;
+            attr->nlink = 2;
+            break;
+
+        case SNAPSHOT:
+            attr->mode  = S_IFREG | 0444;
+            attr->nlink = 1;
+            attr->size  = 4096;
+            break;
+
+        default:
+            attr->mode  = S_IFREG | 0644;
+            attr->nlink = 1;
+            attr->size  = 4096;
+            break;
+    }
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// contents() - Reads the device and formats the contents of a file
+//
+// Registers are shown in hex, fields in decimal.  A snapshot reads every register in its block
+// before formatting any of them, so the values are as close together in time as we can make
+// them.  Registers that are safe to read out of order are spread across threads, the same way
+// -dump does it.
+//=================================================================================================
+string RegisterFS::contents(const node_t& n)
+{
+    char text[100];
+
+    if (n.kind == VALUE)
+    {
+        sprintf(text, "0x%08X\n", (uint32_t)readRegister(baseAddr_, n.axiAddr, false));
+        return text;
+    }
+
+    if (n.kind == FIELD)
+    {
+        uint64_t value = n.fieldSpec ? readField(baseAddr_, n.axiAddr, n.fieldSpec)
+                                     : readRegister(baseAddr_, n.axiAddr, false);
+        sprintf(text, "%lu\n", value);
+        return text;
+    }
+
+    // If we get here, it's a snapshot of the block.  Read every register first, in one batch...
+    const node_t&    block = node_[n.parent - 1];
+    vector<uint32_t> addr;
+    vector<uint64_t> reg;
+    vector<bool>     parallel;
+    for (auto id : block.child)
+    {
+        const node_t& r = node_[id - 1];
+        if (r.kind != REGISTER) continue;
+        reg.push_back(id);
+        addr.push_back(r.axiAddr);
+        parallel.push_back(r.readSafe);
+    }
+
+    vector<uint32_t> value(addr.size());
+    readRegisters(baseAddr_, addr, parallel, threads_, value.data());
+
+    // ...and then format them
+    string result;
+    for (size_t i=0; i<reg.size(); ++i)
+    {
+        const node_t& r = node_[reg[i] - 1];
+        sprintf(text, "%-40s 0x%08X  0x%08X\n", r.name.c_str(), r.axiAddr, value[i]);
+        result += text;
+    }
+
+    return result;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// store() - Parses and performs a write to a file
+//
+// Returns: 0, or a positive errno value
+//=================================================================================================
+int RegisterFS::store(const node_t& n, const char* data, size_t length)
+{
+    char  text[100], *end;
+
+    if (n.kind != VALUE && n.kind != FIELD) return EACCES;
+    if (length == 0 || length >= sizeof(text)) return EINVAL;
+
+    // The value may be in decimal or hex, and may be followed by whitespace
+    memcpy(text, data, length);
+    text[length] = 0;
+    uint64_t value = strtoull(text, &end, 0);
+    while (*end == ' ' || *end == '\t' || *end == '\n' || *end == '\r') ++end;
+    if (end == text || *end) return EINVAL;
+
+    if (n.kind == FIELD && n.fieldSpec)
+        writeField(baseAddr_, n.axiAddr, value, n.fieldSpec);
+    else
+        writeRegister(baseAddr_, n.axiAddr, value, false);
+
+    return 0;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// dispatch() - Handles one request from the kernel
+//=================================================================================================
+void RegisterFS::dispatch(const uint8_t* request, size_t length)
+{
+    auto&       in   = *(const fuse_in_header*)request;
+    const void* body = request + sizeof(fuse_in_header);
+    node_t*     n    = node(in.nodeid);
+
+    // Every request except these refers to a node
+    if (n == nullptr && in.opcode != FUSE_INIT && in.opcode != FUSE_FORGET
+    &&  in.opcode != FUSE_BATCH_FORGET && in.opcode != FUSE_INTERRUPT && in.opcode != FUSE_DESTROY)
+    {
+        reply(in.unique, ENOENT);
+        return;
+    }
+
+    switch (in.opcode)
+    {
+        case FUSE_INIT:
+        {
+            auto& init = *(const fuse_init_in*)body;
+            fuse_init_out out;
+            memset(&out, 0, sizeof(out));
+            out.major         = FUSE_KERNEL_VERSION;
+            out.minor         = FUSE_KERNEL_MINOR_VERSION;
+            out.max_readahead = init.max_readahead;
+            out.max_write     = MAX_WRITE;
+            out.time_gran     = 1;
+            reply(in.unique, 0, &out, sizeof(out));
+            break;
+        }
+
+        case FUSE_LOOKUP:
+        {
+            auto it = n->byName.find((const char*)body);
+            if (it == n->byName.end())
+            {
+                reply(in.unique, ENOENT);
+                break;
+            }
+
+            fuse_entry_out out;
+            memset(&out, 0, sizeof(out));
+            out.nodeid      = it->second;
+            out.entry_valid = CACHE_SECS;
+            out.attr_valid  = CACHE_SECS;
+            getAttr(it->second, &out.attr);
+            reply(in.unique, 0, &out, sizeof(out));
+            break;
+        }
+
+        // Truncating a file (as the shell does for "echo 1 > file") is a no-op
+        case FUSE_SETATTR:
+        case FUSE_GETATTR:
+        {
+            fuse_attr_out out;
+            memset(&out, 0, sizeof(out));
+            out.attr_valid = CACHE_SECS;
+            getAttr(in.nodeid, &out.attr);
+            reply(in.unique, 0, &out, sizeof(out));
+            break;
+        }
+
+        case FUSE_OPENDIR:
+        {
+            fuse_open_out out;
+            memset(&out, 0, sizeof(out));
+            reply(in.unique, 0, &out, sizeof(out));
+            break;
+        }
+
+        // Directory listings come straight from the tree.  Entry 'i' is at offset 'i', with
+        // "." and ".." as entries 0 and 1.
+        case FUSE_READDIR:
+        {
+            auto&        read = *(const fuse_read_in*)body;
+            vector<char> out;
+
+            for (uint64_t i = read.offset; i < n->child.size() + 2; ++i)
+            {
+                uint64_t      id   = (i == 0) ? in.nodeid : (i == 1) ? (n->parent ? n->parent : 1)
+                                                                     : n->child[i - 2];
+                const string& name = (i == 0) ? "." : (i == 1) ? ".." : node_[id - 1].name;
+                size_t        size = FUSE_DIRENT_ALIGN(FUSE_NAME_OFFSET + name.size());
+
+                if (out.size() + size > read.size) break;
+
+                size_t at = out.size();
+                out.resize(at + size, 0);
+                auto& entry   = *(fuse_dirent*)&out[at];
+                entry.ino     = id;
+                entry.off     = i + 1;
+                entry.namelen = name.size();
+                entry.type    = (node_[id - 1].kind <= REGISTER) ? DT_DIR : DT_REG;
+                memcpy(entry.name, name.data(), name.size());
+            }
+
+            reply(in.unique, 0, out.data(), out.size());
+            break;
+        }
+
+        case FUSE_OPEN:
+        {
+            auto& open = *(const fuse_open_in*)body;
+
+            if (n->kind <= REGISTER)
+            {
+                reply(in.unique, EISDIR);
+                break;
+            }
+
+            if (n->kind == SNAPSHOT && (open.flags & O_ACCMODE) != O_RDONLY)
+            {
+                reply(in.unique, EACCES);
+                break;
+            }
+
+            fuse_open_out out;
+            memset(&out, 0, sizeof(out));
+            out.fh         = nextHandle_++;
+            out.open_flags = FOPEN_DIRECT_IO;
+            openFile_[out.fh];
+            reply(in.unique, 0, &out, sizeof(out));
+            break;
+        }
+
+        case FUSE_READ:
+        {
+            auto&   read = *(const fuse_read_in*)body;
+            string& text = openFile_[read.fh];
+
+            if (read.offset == 0) text = contents(*n);
+
+            if (read.offset >= text.size())
+                reply(in.unique, 0);
+            else
+                reply(in.unique, 0, text.data() + read.offset, min<size_t>(read.size, text.size() - read.offset));
+            break;
+        }
+
+        case FUSE_WRITE:
+        {
+            auto& write = *(const fuse_write_in*)body;
+            auto  data  = (const char*)body + sizeof(fuse_write_in);
+
+            int error = store(*n, data, write.size);
+            if (error)
+            {
+                reply(in.unique, error);
+                break;
+            }
+
+            fuse_write_out out;
+            memset(&out, 0, sizeof(out));
+            out.size = write.size;
+            reply(in.unique, 0, &out, sizeof(out));
+            break;
+        }
+
+        case FUSE_RELEASE:
+            openFile_.erase(((const fuse_release_in*)body)->fh);
+            reply(in.unique, 0);
+            break;
+
+        case FUSE_RELEASEDIR:
+        case FUSE_FLUSH:
+        case FUSE_FSYNC:
+        case FUSE_FSYNCDIR:
+        case FUSE_ACCESS:
+            reply(in.unique, 0);
+            break;
+
+        case FUSE_STATFS:
+        {
+            fuse_statfs_out out;
+            memset(&out, 0, sizeof(out));
+            out.st.bsize   = 4096;
+            out.st.frsize  = 4096;
+            out.st.namelen = 255;
+            out.st.files   = node_.size();
+            reply(in.unique, 0, &out, sizeof(out));
+            break;
+        }
+
+        // A rebuild can remove nodes, but a node ID is never reused for another path: a node
+        // that disappears stays in node_, marked not live.  So the kernel's lookup counts can
+        // safely be ignored, and there's nothing to forget.
+        case FUSE_FORGET:
+        case FUSE_BATCH_FORGET:
+        case FUSE_INTERRUPT:
+            break;
+
+        case FUSE_DESTROY:
+            stopRequested_ = true;
+            reply(in.unique, 0);
+            break;
+
+        default:
+            reply(in.unique, ENOSYS);
+            break;
+    }
+}
+//=================================================================================================
@@ -0,0 +1,132 @@
+//=================================================================================================
+// RegisterFS.h - Defines a FUSE filesystem that exposes registers and fields as files
+//
+// The tree looks like this:
+//
+//     <mountpoint>/<block>/snapshot                 Every register in the block, read together
+//     <mountpoint>/<block>/<register>/value         The entire register
+//     <mountpoint>/<block>/<register>/<field>       One field within the register
+//
+// A block is the part of a register name before the first underscore ("GLOBAL", "QSFP", etc)
+//=================================================================================================
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <atomic>
+#include "SymbolTable.h"
+#include "SymbolWatcher.h"
+
+class RegisterFS
+{
+public:
+
+    // Constructor: 'baseAddr' and 'regionSize' describe the mapped PCI region.  A snapshot spreads
+    // its read-safe registers across 'threads' threads.
+    RegisterFS(uint8_t* baseAddr, size_t regionSize, int threads = 1)
+        : baseAddr_(baseAddr), regionSize_(regionSize), threads_(threads) {}
+
+    // Destructor
+    ~RegisterFS() {unmount();}
+
+    // No copy or assignment constructor - objects of this class can't be copied
+    RegisterFS (const RegisterFS&) = delete;
+    RegisterFS& operator= (const RegisterFS&) = delete;
+
+    // Builds the directory tree from a symbol table.  When the tree is rebuilt, every path that
+    // still exists keeps its node ID, so handles the kernel already holds remain valid.
+    void    build(const SymbolTable& symbols);
+
+    // Rebuilds the tree whenever the watcher swaps in new symbols
+    void    watch(SymbolWatcher* watcher) {watcher_ = watcher;}
+
+    // Mounts the filesystem on an existing directory
+    void    mount(const std::string& mountPoint);
+
+    // Serves requests until the filesystem is unmounted or stop() is called
+    void    run();
+
+    // Unmounts the filesystem
+    void    unmount();
+
+    // Asks run() to return.  This is safe to call from a signal handler.
+    static void stop() {stopRequested_ = true;}
+
+    // Number of requests served so far
+    uint64_t requests() const {return requests_;}
+
+protected:
+
+    // The kinds of node in the tree
+    enum kind_t {ROOT, BLOCK, REGISTER, FIELD, VALUE, SNAPSHOT};
+
+    // One file or directory
+    struct node_t
+    {
+        bool        live;
+        uint64_t    parent;
+        std::string name;
+        kind_t      kind;
+        uint32_t    axiAddr;
+        uint32_t    fieldSpec;
+        std::vector<uint64_t> child;
+        std::unordered_map<std::string, uint64_t> byName;
+        bool        readSafe = false;   // For a register, true if reading it has no side effects
+    };
+
+    // Adds a node to the tree and returns its node ID
+    uint64_t addNode(uint64_t parent, const std::string& name, kind_t kind,
+                     uint32_t axiAddr = 0, uint32_t fieldSpec = 0);
+
+    // Returns the node with the specified ID, or nullptr if there isn't one (anymore)
+    node_t* node(uint64_t id)
+    {
+        return (id >= 1 && id <= node_.size() && node_[id - 1].live) ? &node_[id - 1] : nullptr;
+    }
+
+    // Reads the device and formats the contents of a file
+    std::string contents(const node_t& n);
+
+    // Parses and performs a write to a file.  Returns 0 or a (positive) errno
+    int     store(const node_t& n, const char* data, size_t length);
+
+    // Sends a reply to the kernel
+    void    reply(uint64_t unique, int error, const void* data = nullptr, size_t length = 0);
+
+    // Handles one request from the kernel
+    void    dispatch(const uint8_t* request, size_t length);
+
+    // Fills in the attributes of a node
+    void    getAttr(uint64_t id, struct fuse_attr* attr);
+
+    // The mapped PCI region
+    uint8_t*    baseAddr_;
+    size_t      regionSize_;
+    int         threads_;
+
+    // Every node there has ever been.  Node ID 'n' is node_[n-1], and the root is node ID 1.
+    // Nodes whose paths disappear in a rebuild stay here, marked as not live.
+    std::vector<node_t> node_;
+
+    // Maps "<parent-id>/<name>" to a node ID, so a rebuild can find the ID of an existing path
+    std::unordered_map<std::string, uint64_t> nodeID_;
+
+    // Where new symbols come from, and which generation of them the tree was built from
+    SymbolWatcher* watcher_ = nullptr;
+    uint64_t    generation_ = 0;
+
+    // The contents of each open file, captured when it's read from offset 0
+    std::map<uint64_t, std::string> openFile_;
+    uint64_t    nextHandle_ = 1;
+
+    // The FUSE device and where we're mounted
+    int         fd_ = -1;
+    std::string mountPoint_;
+    uint64_t    mountTime_ = 0;
+
+    uint64_t    requests_ = 0;
+
+    static std::atomic<bool> stopRequested_;
+};
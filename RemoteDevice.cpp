@@ -0,0 +1,220 @@
+//=================================================================================================
+// RemoteDevice.cpp - Implements a class that forwards register operations to a pcireg server
+//
+// Each operation costs a round trip, so the operations that would otherwise loop over the link
+// are sent as one request: a wait polls on the server, and a field write is read-modify-written
+// there.  Lists of reads are pipelined, with many requests in flight at once.
+//=================================================================================================
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <stdexcept>
+#include "RemoteDevice.h"
+using namespace std;
+using namespace RemoteProtocol;
+
+RemoteDevice* Remote = nullptr;
+
+
+//=================================================================================================
+// connect() - Connects to a server
+//=================================================================================================
+void RemoteDevice::connect(const string& endpoint)
+{
+    close();
+    fd_       = connectTo(endpoint);
+    endpoint_ = endpoint;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// close() - Closes the connection
+//=================================================================================================
+void RemoteDevice::close()
+{
+    if (fd_ >= 0) ::close(fd_);
+    fd_ = -1;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// execute() - Sends a batch of requests and collects the responses
+//
+// Requests are sent as fast as the window allows, and responses are matched to requests by ID,
+// so the server is free to answer them in any order.  Limiting the window also keeps both ends
+// from blocking on full socket buffers at the same time.
+//=================================================================================================
+void RemoteDevice::execute(vector<request_t>& request, vector<response_t>& response)
+{
+    response_t  in[WINDOW];
+    size_t      sent = 0, received = 0, have = 0;
+    uint32_t    firstID = nextID_;
+
+    if (fd_ < 0) throw runtime_error("pcireg : not connected to a server");
+
+    // Number the requests
+    for (auto& r : request) r.id = nextID_++;
+
+    response.resize(request.size());
+
+    while (received < request.size())
+    {
+        // Top up the window
+        size_t limit = min(request.size(), received + WINDOW);
+        if (sent < limit)
+        {
+            if (!sendAll(fd_, &request[sent], (limit - sent) * sizeof(request_t)))
+            {
+                throw runtime_error("pcireg : lost connection to "+endpoint_);
+            }
+            sent = limit;
+        }
+
+        // Wait for at least one response, and take as many as have arrived
+        ssize_t n = recv(fd_, (uint8_t*)in + have, (sent - received) * sizeof(response_t) - have, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) throw runtime_error("pcireg : lost connection to "+endpoint_);
+        have += n;
+
+        // File each complete response under the request it answers
+        size_t whole = have / sizeof(response_t);
+        for (size_t i=0; i<whole; ++i)
+        {
+            uint32_t index = in[i].id - firstID;
+            if (index >= request.size()) throw runtime_error("pcireg : bad response from "+endpoint_);
+            response[index] = in[i];
+        }
+        received += whole;
+
+        // Keep any partial response for next time
+        have -= whole * sizeof(response_t);
+        memmove(in, (uint8_t*)in + whole * sizeof(response_t), have);
+    }
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// fail() - Throws an exception describing a request that the server refused
+//=================================================================================================
+void RemoteDevice::fail(const request_t& request, int32_t status)
+{
+    char text[200];
+    sprintf(text, "pcireg : %s refused the request for 0x%X : %s", endpoint_.c_str(),
+            request.axiAddr, strerror(-status));
+    throw runtime_error(text);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// call() - Executes a single request and returns the response.  Throws if the request fails.
+//=================================================================================================
+response_t RemoteDevice::call(uint8_t op, uint32_t axiAddr, uint32_t fieldSpec, uint64_t value,
+                              uint16_t flags, uint32_t timeoutMs)
+{
+    vector<request_t>  request(1);
+    vector<response_t> response;
+
+    memset(&request[0], 0, sizeof(request_t));
+    request[0].op        = op;
+    request[0].region    = region_;
+    request[0].flags     = flags;
+    request[0].axiAddr   = axiAddr;
+    request[0].fieldSpec = fieldSpec;
+    request[0].value     = value;
+    request[0].timeoutMs = timeoutMs;
+    request[0].qos       = (qos_ == QOS_AUTO) ? QOS_INTERACTIVE : qos_;
+
+    execute(request, response);
+    if (response[0].status < 0) fail(request[0], response[0].status);
+    return response[0];
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// regionSize() - Returns the size of one of the server's regions, or 0 if there is no such region
+//=================================================================================================
+size_t RemoteDevice::regionSize(int region)
+{
+    int saved = region_;
+    region_   = region;
+
+    try
+    {
+        response_t r = call(OP_REGION, 0);
+        region_ = saved;
+        return r.value;
+    }
+    catch (const std::exception&)
+    {
+        region_ = saved;
+        return 0;
+    }
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// The single operations
+//=================================================================================================
+void RemoteDevice::writeRegister(uint32_t axiAddr, uint64_t data, bool wide)
+{
+    call(OP_WRITE, axiAddr, 0, data, wide ? FLAG_WIDE : 0);
+}
+
+uint64_t RemoteDevice::readRegister(uint32_t axiAddr, bool wide)
+{
+    return call(OP_READ, axiAddr, 0, 0, wide ? FLAG_WIDE : 0).value;
+}
+
+void RemoteDevice::writeField(uint32_t axiAddr, uint64_t data, uint32_t fieldSpec)
+{
+    call(OP_WRITE_FIELD, axiAddr, fieldSpec, data);
+}
+
+uint64_t RemoteDevice::readField(uint32_t axiAddr, uint32_t fieldSpec)
+{
+    return call(OP_READ_FIELD, axiAddr, fieldSpec).value;
+}
+
+bool RemoteDevice::waitRegister(uint32_t axiAddr, uint32_t fieldSpec, bool wide, uint64_t value,
+                                uint32_t timeoutMs, uint64_t* lastValue)
+{
+    response_t r = call(OP_WAIT, axiAddr, fieldSpec, value, wide ? FLAG_WIDE : 0, timeoutMs);
+    if (lastValue) *lastValue = r.value;
+    return r.status == STATUS_OK;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// readRegisters() - Reads a list of 32-bit registers as one pipelined batch
+//=================================================================================================
+void RemoteDevice::readRegisters(const vector<uint32_t>& axiAddr, uint32_t* value)
+{
+    vector<request_t>  request(axiAddr.size());
+    vector<response_t> response;
+
+    for (size_t i=0; i<axiAddr.size(); ++i)
+    {
+        memset(&request[i], 0, sizeof(request_t));
+        request[i].op      = OP_READ;
+        request[i].region  = region_;
+        request[i].axiAddr = axiAddr[i];
+        request[i].qos     = (qos_ == QOS_AUTO) ? QOS_BULK : qos_;
+    }
+
+    execute(request, response);
+
+    for (size_t i=0; i<axiAddr.size(); ++i)
+    {
+        if (response[i].status < 0) fail(request[i], response[i].status);
+        value[i] = (uint32_t)response[i].value;
+    }
+}
+//=================================================================================================
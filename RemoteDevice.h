@@ -0,0 +1,75 @@
+//=================================================================================================
+// RemoteDevice.h - Defines a class that forwards register operations to a pcireg server
+//
+// While a connection is open, the global 'Remote' points to it and the routines in RegAccess
+// send every operation to the server instead of touching local memory.
+//=================================================================================================
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "RemoteProtocol.h"
+
+class RemoteDevice
+{
+public:
+
+    // Constructor and destructor
+    RemoteDevice() {}
+    ~RemoteDevice() {close();}
+
+    // No copy or assignment constructor - objects of this class can't be copied
+    RemoteDevice (const RemoteDevice&) = delete;
+    RemoteDevice& operator= (const RemoteDevice&) = delete;
+
+    // Connects to a server at "unix:/path" or "host:port"
+    void        connect(const std::string& endpoint);
+
+    // Closes the connection
+    void        close();
+
+    // Returns the size of one of the server's regions, or 0 if it has no such region
+    size_t      regionSize(int region);
+
+    // Chooses the region that subsequent operations apply to
+    void        selectRegion(int region) {region_ = region;}
+
+    // Chooses the QoS class of subsequent operations.  By default (QOS_AUTO), single operations
+    // are interactive and pipelined batches are bulk.
+    void        setQos(uint8_t qos) {qos_ = qos;}
+
+    // These mirror the routines in RegAccess.h
+    void        writeRegister(uint32_t axiAddr, uint64_t data, bool wide);
+    uint64_t    readRegister (uint32_t axiAddr, bool wide);
+    void        writeField   (uint32_t axiAddr, uint64_t data, uint32_t fieldSpec);
+    uint64_t    readField    (uint32_t axiAddr, uint32_t fieldSpec);
+    bool        waitRegister (uint32_t axiAddr, uint32_t fieldSpec, bool wide, uint64_t value,
+                              uint32_t timeoutMs, uint64_t* lastValue);
+    void        readRegisters(const std::vector<uint32_t>& axiAddr, uint32_t* value);
+
+    // Sends a batch of requests and collects the responses, keeping up to WINDOW requests in
+    // flight at once.  Assigns the request IDs.  On return, response[i] answers request[i].
+    void        execute(std::vector<RemoteProtocol::request_t>& request,
+                        std::vector<RemoteProtocol::response_t>& response);
+
+    // The maximum number of requests in flight
+    static const size_t WINDOW = RemoteProtocol::WINDOW;
+
+protected:
+
+    // Executes a single request and throws if it fails.  Returns the response
+    RemoteProtocol::response_t call(uint8_t op, uint32_t axiAddr, uint32_t fieldSpec = 0,
+                                    uint64_t value = 0, uint16_t flags = 0, uint32_t timeoutMs = 0);
+
+    // Throws an exception describing a failed request
+    [[noreturn]] void fail(const RemoteProtocol::request_t& request, int32_t status);
+
+    std::string endpoint_;
+    int         fd_ = -1;
+    int         region_ = 0;
+    uint8_t     qos_ = RemoteProtocol::QOS_AUTO;
+    uint32_t    nextID_ = 1;
+};
+
+// The open connection, or nullptr if registers are being accessed locally
+extern RemoteDevice* Remote;
@@ -0,0 +1,203 @@
+//=================================================================================================
+// RemoteProtocol.cpp - Implements the socket plumbing shared by the remote client and server
+//=================================================================================================
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdexcept>
+#include "RemoteProtocol.h"
+using namespace std;
+
+namespace RemoteProtocol
+{
+
+//=================================================================================================
+// unixAddress() - Fills in a Unix-domain socket address.  Returns false if 'endpoint' isn't one
+//=================================================================================================
+static bool unixAddress(const string& endpoint, sockaddr_un* addr)
+{
+    if (endpoint.compare(0, 5, "unix:") != 0) return false;
+
+    string path = endpoint.substr(5);
+    if (path.empty() || path.size() >= sizeof(addr->sun_path))
+    {
+        throw runtime_error("pcireg : bad socket path "+endpoint);
+    }
+
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    strcpy(addr->sun_path, path.c_str());
+    return true;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// resolve() - Looks up a "host:port" endpoint.  The caller must freeaddrinfo() the result.
+//             An endpoint with no host means this host's loopback address.
+//=================================================================================================
+static addrinfo* resolve(const string& endpoint)
+{
+    addrinfo hints, *result;
+
+    size_t colon = endpoint.rfind(':');
+    if (colon == string::npos) throw runtime_error("pcireg : endpoint must be unix:<path> or <host>:<port>");
+
+    string host = endpoint.substr(0, colon);
+    string port = endpoint.substr(colon + 1);
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family   = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    // With no host, getaddrinfo() gives the loopback address.  We never ask it for the wildcard
+    // address, so a server only listens on every interface if the user says so ("0.0.0.0:port").
+    int error = getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &result);
+    if (error) throw runtime_error("pcireg : cant resolve "+endpoint+" : "+gai_strerror(error));
+    return result;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// connectTo() - Connects to a server
+//=================================================================================================
+int connectTo(const string& endpoint)
+{
+    sockaddr_un unixAddr;
+
+    if (unixAddress(endpoint, &unixAddr))
+    {
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd >= 0 && connect(fd, (sockaddr*)&unixAddr, sizeof(unixAddr)) == 0) return fd;
+        if (fd >= 0) close(fd);
+        throw runtime_error("pcireg : cant connect to "+endpoint+" : "+strerror(errno));
+    }
+
+    addrinfo* list = resolve(endpoint);
+    for (addrinfo* ai = list; ai; ai = ai->ai_next)
+    {
+        int fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+        if (fd < 0) continue;
+
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0)
+        {
+            // Requests are small and we batch them ourselves, so don't let Nagle delay them
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            freeaddrinfo(list);
+            return fd;
+        }
+
+        close(fd);
+    }
+
+    freeaddrinfo(list);
+    throw runtime_error("pcireg : cant connect to "+endpoint);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// listenOn() - Creates a listening socket
+//=================================================================================================
+int listenOn(const string& endpoint)
+{
+    sockaddr_un unixAddr;
+    int         fd = -1;
+
+    if (unixAddress(endpoint, &unixAddr))
+    {
+        // A socket file left behind by an earlier server would make bind() fail
+        unlink(unixAddr.sun_path);
+
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0 || bind(fd, (sockaddr*)&unixAddr, sizeof(unixAddr)) < 0 || listen(fd, 16) < 0)
+        {
+            if (fd >= 0) close(fd);
+            throw runtime_error("pcireg : cant listen on "+endpoint+" : "+strerror(errno));
+        }
+        return fd;
+    }
+
+    addrinfo* list = resolve(endpoint);
+    for (addrinfo* ai = list; ai; ai = ai->ai_next)
+    {
+        fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+        if (fd < 0) continue;
+
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (bind(fd, ai->ai_addr, ai->ai_addrlen) == 0 && listen(fd, 16) == 0) break;
+
+        close(fd);
+        fd = -1;
+    }
+
+    freeaddrinfo(list);
+    if (fd < 0) throw runtime_error("pcireg : cant listen on "+endpoint);
+    return fd;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// sendAll() / recvAll() - Write or read exactly 'length' bytes
+//=================================================================================================
+bool sendAll(int fd, const void* data, size_t length)
+{
+    auto p = (const uint8_t*)data;
+    while (length)
+    {
+        ssize_t n = send(fd, p, length, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        length -= n;
+    }
+    return true;
+}
+
+bool recvAll(int fd, void* data, size_t length)
+{
+    auto p = (uint8_t*)data;
+    while (length)
+    {
+        ssize_t n = recv(fd, p, length, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        length -= n;
+    }
+    return true;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// qosName() / parseQos() - Convert between QoS class names and values
+//=================================================================================================
+static const char* qosNames[QOS_CLASSES] = {"auto", "control", "interactive", "bulk"};
+
+const char* qosName(int qos)
+{
+    return (qos >= 0 && qos < QOS_CLASSES) ? qosNames[qos] : "unknown";
+}
+
+bool parseQos(const string& name, uint8_t* qos)
+{
+    for (int i=0; i<QOS_CLASSES; ++i) if (name == qosNames[i])
+    {
+        *qos = i;
+        return true;
+    }
+    return false;
+}
+//=================================================================================================
+
+}
@@ -0,0 +1,96 @@
+//=================================================================================================
+// RemoteProtocol.h - Defines the wire protocol between a remote pcireg client and a pcireg server
+//
+// A client sends fixed-size requests over a stream socket and the server answers each one with a
+// fixed-size response that carries the same ID.  A client may have many requests in flight at
+// once, up to WINDOW of them; responses are matched to requests by ID, never by order.
+//
+// Both ends are assumed to share a byte order (in practice, both are x86).
+//=================================================================================================
+#pragma once
+#include <stdint.h>
+#include <string>
+
+namespace RemoteProtocol
+{
+    // The most requests a client may have unanswered.  The server disconnects a client that
+    // sends more.
+    const size_t WINDOW = 256;
+
+    // Operations a client can ask for
+    enum op_t : uint8_t
+    {
+        OP_PING,            // Does nothing
+        OP_REGION,          // Returns the size of region 'region', or fails with -ENODEV
+        OP_READ,            // Reads a register (a pair, if FLAG_WIDE)
+        OP_WRITE,           // Writes a register (a pair, if FLAG_WIDE)
+        OP_READ_FIELD,      // Reads a bit-field
+        OP_WRITE_FIELD,     // Read-modify-writes a bit-field
+        OP_WAIT             // Polls until a register or field holds 'value', or 'timeoutMs' passes
+    };
+
+    // Request flags
+    enum : uint16_t
+    {
+        FLAG_WIDE = 1
+    };
+
+    // Quality-of-service classes, highest priority first.  QOS_AUTO lets the client library
+    // choose: single operations are interactive, pipelined batches are bulk.
+    enum qos_t : uint8_t
+    {
+        QOS_AUTO,
+        QOS_CONTROL,        // Control loops: small, frequent, latency-critical
+        QOS_INTERACTIVE,    // A person at a command line
+        QOS_BULK,           // Dumps, sampling sweeps, snapshots
+        QOS_CLASSES
+    };
+
+    // Response status.  Negative values are (negated) errno values
+    enum : int32_t
+    {
+        STATUS_OK      = 0,
+        STATUS_TIMEOUT = 1
+    };
+
+    struct request_t
+    {
+        uint32_t id;
+        uint8_t  op;
+        uint8_t  region;
+        uint16_t flags;
+        uint32_t axiAddr;
+        uint32_t fieldSpec;
+        uint64_t value;
+        uint32_t timeoutMs;
+        uint8_t  qos;
+        uint8_t  reserved[3];
+    };
+
+    struct response_t
+    {
+        uint32_t id;
+        int32_t  status;
+        uint64_t value;
+    };
+
+    static_assert(sizeof(request_t)  == 32, "request_t must be 32 bytes");
+    static_assert(sizeof(response_t) == 16, "response_t must be 16 bytes");
+
+    // Connects to an endpoint of the form "unix:/path/to/socket" or "host:port".
+    // Returns a socket descriptor
+    int     connectTo(const std::string& endpoint);
+
+    // Converts between QoS class names and values.  parseQos() returns false on a bad name
+    const char* qosName(int qos);
+    bool        parseQos(const std::string& name, uint8_t* qos);
+
+    // Creates a listening socket on an endpoint of the same form.  ":port" listens on the loopback
+    // address only; to listen on every interface, say so with "0.0.0.0:port".  Returns a socket
+    // descriptor
+    int     listenOn(const std::string& endpoint);
+
+    // Writes/reads exactly 'length' bytes.  Return false if the connection closes
+    bool    sendAll(int fd, const void* data, size_t length);
+    bool    recvAll(int fd, void* data, size_t length);
+}
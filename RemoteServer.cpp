@@ -0,0 +1,485 @@
+//=================================================================================================
+// RemoteServer.cpp - Implements a server that performs register operations on behalf of remote
+//                    pcireg clients
+//
+// Each client has a thread that receives its requests and queues them by QoS class.  A single
+// executor thread owns the device and performs every request, so the order in which requests
+// reach the hardware is decided in exactly one place:
+//
+//   - Classes are served in priority order, except that a class whose oldest request has been
+//     queued longer than its latency target goes first.  That keeps bulk work from starving.
+//
+//   - Within a class, clients take turns.  On its turn, a client may have up to the class's
+//     budget of requests performed.  Bulk work is thereby chunked: between any two chunks, the
+//     executor looks for higher-priority work.
+//
+//   - A wait is polled every WAIT_POLL_NS between other work, or at its deadline if that comes
+//     sooner, rather than spinning on the device.  A client waiting on a slow register holds up
+//     nobody, and an executor with nothing but waits to poll sleeps between polls.
+//
+// Responses for a turn are sent with a single non-blocking write.  A client keeps no more than
+// a window of requests in flight, so its socket buffer always has room; one that doesn't read
+// its responses is disconnected rather than allowed to stall the executor.  So is one that sends
+// more than a window of requests without waiting for the answers, which would otherwise let it
+// queue unbounded work (and memory) on the server.
+//=================================================================================================
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <algorithm>
+#include <stdexcept>
+#include "RemoteServer.h"
+#include "RegAccess.h"
+using namespace std;
+using namespace RemoteProtocol;
+
+atomic<bool> RemoteServer::stopRequested_(false);
+
+// How often pending waits are polled, in nanoseconds
+static const uint64_t WAIT_POLL_NS = 20000;
+
+// Budgets and latency targets, indexed by QoS class
+const RemoteServer::policy_t RemoteServer::policy[QOS_CLASSES] =
+{
+    {16,       1000000},    // QOS_AUTO is treated as QOS_INTERACTIVE
+    { 4,        100000},    // QOS_CONTROL     : 100 us
+    {16,       1000000},    // QOS_INTERACTIVE :   1 ms
+    {32,      50000000}     // QOS_BULK        :  50 ms
+};
+
+
+//=================================================================================================
+// startThread() - Starts a thread with every signal blocked, so that signals meant to interrupt
+//                 serve() are always delivered to the thread that runs it
+//=================================================================================================
+template <class... Args> static thread startThread(Args&&... args)
+{
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    thread t(std::forward<Args>(args)...);
+    pthread_sigmask(SIG_SETMASK, &old, nullptr);
+    return t;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// serve() - Accepts clients and serves them until stop() is called
+//
+// stop() interrupts the poll() only if the signal handler that calls it was installed without
+// SA_RESTART.
+//=================================================================================================
+void RemoteServer::serve(const string& endpoint)
+{
+    int listener = listenOn(endpoint);
+
+    thread executor = startThread(&RemoteServer::execute, this);
+
+    while (!stopRequested_)
+    {
+        reap();
+
+        pollfd pfd = {listener, POLLIN, 0};
+        if (poll(&pfd, 1, 1000) <= 0) continue;
+
+        int fd = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd < 0) continue;
+
+        auto client = make_shared<client_t>();
+        client->fd  = fd;
+
+        lock_guard<mutex> lock(lock_);
+        client_.push_back(client);
+        client->reader = startThread(&RemoteServer::receive, this, client);
+    }
+
+    ::close(listener);
+    if (endpoint.compare(0, 5, "unix:") == 0) unlink(endpoint.c_str() + 5);
+
+    // Disconnect every client
+    {
+        lock_guard<mutex> lock(lock_);
+        for (auto& c : client_) shutdown(c->fd, SHUT_RDWR);
+    }
+
+    while (true)
+    {
+        reap();
+        lock_guard<mutex> lock(lock_);
+        if (client_.empty()) break;
+        this_thread::sleep_for(chrono::milliseconds(10));
+    }
+
+    // And stop the executor.  Anything still queued is abandoned.
+    {
+        lock_guard<mutex> lock(lock_);
+        stopExecutor_ = true;
+    }
+    wakeup_.notify_one();
+    executor.join();
+
+    for (auto& a : active_) a.clear();
+    waits_.clear();
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// receive() - Queues one client's requests until it disconnects, or until it has more than
+//             WINDOW requests unanswered
+//=================================================================================================
+void RemoteServer::receive(clientPtr client)
+{
+    request_t in[256];
+    size_t    have     = 0;
+    bool      overflow = false;
+
+    while (!overflow)
+    {
+        ssize_t n = recv(client->fd, (uint8_t*)in + have, sizeof(in) - have, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        have += n;
+
+        uint64_t arrived = RegStats::now();
+        size_t   whole   = have / sizeof(request_t);
+
+        // Queue every complete request under its class
+        {
+            lock_guard<mutex> lock(lock_);
+            for (size_t i=0; i<whole; ++i)
+            {
+                if (++client->unanswered > WINDOW)
+                {
+                    overflow = true;
+                    break;
+                }
+
+                int qos = in[i].qos;
+                if (qos == QOS_AUTO || qos >= QOS_CLASSES) qos = QOS_INTERACTIVE;
+
+                auto& queue = client->queue[qos];
+                if (queue.empty()) active_[qos].push_back(client);
+                queue.push_back({in[i], arrived});
+            }
+        }
+        wakeup_.notify_one();
+
+        // Keep any partial request for next time
+        have -= whole * sizeof(request_t);
+        memmove(in, (uint8_t*)in + whole * sizeof(request_t), have);
+    }
+
+    if (overflow) shutdown(client->fd, SHUT_RDWR);
+
+    lock_guard<mutex> lock(lock_);
+    client->done = true;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// reap() - Joins the threads of clients that have disconnected.  Their sockets are closed once
+//          the executor has finished with any requests they left behind.
+//=================================================================================================
+void RemoteServer::reap()
+{
+    lock_guard<mutex> lock(lock_);
+
+    for (auto it = client_.begin(); it != client_.end(); )
+    {
+        if (!(*it)->done)
+        {
+            ++it;
+            continue;
+        }
+
+        (*it)->reader.join();
+        it = client_.erase(it);
+    }
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// choose() - Chooses the class and the client to serve next
+//
+// On Exit: qos    = the class to serve
+//          client = the client whose turn it is.  It has been taken off the round-robin list.
+//=================================================================================================
+bool RemoteServer::choose(int* qos, clientPtr* client)
+{
+    uint64_t now    = RegStats::now();
+    int      chosen = -1;
+
+    // Take the highest-priority class that's overdue, or failing that, the highest-priority
+    // class that has anything queued
+    for (int c = QOS_CONTROL; c < QOS_CLASSES; ++c)
+    {
+        if (active_[c].empty()) continue;
+        if (chosen < 0) chosen = c;
+
+        uint64_t arrived = active_[c].front()->queue[c].front().arrived;
+        if (now > arrived && now - arrived > policy[c].targetNs)
+        {
+            chosen = c;
+            break;
+        }
+    }
+
+    if (chosen < 0) return false;
+
+    *qos    = chosen;
+    *client = active_[chosen].front();
+    active_[chosen].pop_front();
+    return true;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// execute() - Performs every client's requests, a turn at a time, and polls pending waits
+//=================================================================================================
+void RemoteServer::execute()
+{
+    vector<job_t>      batch;
+    vector<response_t> out;
+    uint64_t           nextPoll = 0;
+
+    while (true)
+    {
+        int       qos = 0;
+        clientPtr client;
+
+        // Find the next turn.  If there's nothing to do, sleep until there is, or until it's time
+        // to poll the waits.
+        {
+            unique_lock<mutex> lock(lock_);
+            while (!stopExecutor_ && !choose(&qos, &client))
+            {
+                if (waits_.empty())
+                    wakeup_.wait(lock);
+                else if (RegStats::now() < nextPoll)
+                    wakeup_.wait_until(lock, chrono::steady_clock::time_point(chrono::nanoseconds(nextPoll)));
+                else
+                    break;
+            }
+            if (stopExecutor_) return;
+
+            // Take this turn's share of the client's queue.  If there's more, it goes to the
+            // back of the line.
+            if (client)
+            {
+                auto&  queue = client->queue[qos];
+                size_t count = min<size_t>(queue.size(), policy[qos].budget);
+                batch.assign(queue.begin(), queue.begin() + count);
+                queue.erase(queue.begin(), queue.begin() + count);
+                if (!queue.empty()) active_[qos].push_back(client);
+            }
+        }
+
+        // Perform the turn's requests
+        if (client)
+        {
+            out.clear();
+            for (auto& job : batch)
+            {
+                uint64_t start = RegStats::now();
+                uint64_t delay = start - job.arrived;
+                delay_[qos].record(delay);
+                if (delay > policy[qos].targetNs) ++late_[qos];
+
+                response_t response;
+                if (perform(job.request, &response))
+                    out.push_back(response);
+                else
+                    waits_.push_back({client, job.request, start + job.request.timeoutMs * 1000000ULL});
+            }
+
+            // Count the responses as answered before sending them, so that a client that sends
+            // its next request the moment it reads one is never over the window
+            requests_ += batch.size();
+            client->unanswered -= out.size();
+            if (!out.empty()) reply(*client, out.data(), out.size());
+        }
+
+        if (!waits_.empty() && RegStats::now() >= nextPoll) nextPoll = pollWaits();
+    }
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// current() - Reads the register or field that a wait is polling
+//=================================================================================================
+static uint64_t current(uint8_t* base, const request_t& request)
+{
+    if (request.fieldSpec) return readField(base, request.axiAddr, request.fieldSpec);
+    return readRegister(base, request.axiAddr, (request.flags & FLAG_WIDE) != 0);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// pollWaits() - Polls every pending wait once, and answers the ones that are satisfied or have
+//               timed out
+//
+// Returns: the time (per RegStats::now()) at which the waits that are left should next be polled
+//=================================================================================================
+uint64_t RemoteServer::pollWaits()
+{
+    uint64_t now = RegStats::now();
+
+    auto finished = [&](wait_t& w)
+    {
+        response_t response = {w.request.id, STATUS_OK, 0};
+        response.value = current(region_[w.request.region].baseAddr, w.request);
+
+        if (response.value != w.request.value)
+        {
+            if (now < w.deadline) return false;
+            response.status = STATUS_TIMEOUT;
+        }
+
+        --w.client->unanswered;
+        reply(*w.client, &response, 1);
+        return true;
+    };
+
+    waits_.erase(remove_if(waits_.begin(), waits_.end(), finished), waits_.end());
+
+    // Poll again after the usual interval, or at the nearest deadline if that's sooner
+    uint64_t next = now + WAIT_POLL_NS;
+    for (auto& w : waits_) next = min(next, w.deadline);
+    return next;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// reply() - Sends responses to a client without blocking
+//=================================================================================================
+void RemoteServer::reply(client_t& client, const response_t* response, size_t count)
+{
+    size_t  length = count * sizeof(response_t);
+    ssize_t n      = send(client.fd, response, length, MSG_DONTWAIT | MSG_NOSIGNAL);
+
+    // A client that has gone away is reaped in due course.  A client that has stopped reading
+    // its responses is cut off.
+    if (n >= 0 && (size_t)n < length) shutdown(client.fd, SHUT_RDWR);
+    if (n <  0 && (errno == EAGAIN || errno == EWOULDBLOCK)) shutdown(client.fd, SHUT_RDWR);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// perform() - Performs one request
+//
+// On Exit: response = the response to send, unless the request is a wait that isn't satisfied
+//                     yet, in which case we return false
+//=================================================================================================
+bool RemoteServer::perform(const request_t& request, response_t* response)
+{
+    *response = {request.id, STATUS_OK, 0};
+    bool wide = (request.flags & FLAG_WIDE) != 0;
+
+    // Make sure the region exists and the register is inside it
+    if (request.region >= region_.size())
+    {
+        response->status = -ENODEV;
+        return true;
+    }
+
+    uint8_t* base = region_[request.region].baseAddr;
+    size_t   size = region_[request.region].size;
+
+    if (request.op != OP_PING && request.op != OP_REGION)
+    {
+        if ((uint64_t)request.axiAddr + (wide ? 8 : 4) > size || (request.axiAddr & 3))
+        {
+            response->status = -ERANGE;
+            return true;
+        }
+    }
+
+    // A field must be 1 to 32 bits wide and lie entirely within its register
+    bool field = (request.op == OP_READ_FIELD || request.op == OP_WRITE_FIELD)
+              || (request.op == OP_WAIT && request.fieldSpec != 0);
+    if (field)
+    {
+        uint32_t width = (request.fieldSpec >> 24) & 0xFF;
+        uint32_t pos   = (request.fieldSpec >> 16) & 0xFF;
+        if (width == 0 || width > 32 || pos + width > 32)
+        {
+            response->status = -EINVAL;
+            return true;
+        }
+    }
+
+    switch (request.op)
+    {
+        case OP_PING:
+            break;
+
+        case OP_REGION:
+            response->value = size;
+            break;
+
+        case OP_READ:
+            response->value = readRegister(base, request.axiAddr, wide);
+            break;
+
+        case OP_WRITE:
+            writeRegister(base, request.axiAddr, request.value, wide);
+            break;
+
+        case OP_READ_FIELD:
+            response->value = readField(base, request.axiAddr, request.fieldSpec);
+            break;
+
+        case OP_WRITE_FIELD:
+            writeField(base, request.axiAddr, request.value, request.fieldSpec);
+            break;
+
+        // A wait that's satisfied on the first look is answered straight away
+        case OP_WAIT:
+            response->value = current(base, request);
+            if (response->value == request.value) break;
+            if (request.timeoutMs == 0)
+            {
+                response->status = STATUS_TIMEOUT;
+                break;
+            }
+            return false;
+
+        default:
+            response->status = -EINVAL;
+    }
+
+    return true;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// report() - Prints the queueing delay, in nanoseconds, of each QoS class
+//=================================================================================================
+void RemoteServer::report(FILE* ofile)
+{
+    fprintf(ofile, "%-12s %10s %10s %10s %10s %10s %10s %10s\n",
+            "class", "requests", "mean", "p50", "p99", "max", "target", "late");
+
+    for (int c = QOS_CONTROL; c < QOS_CLASSES; ++c)
+    {
+        auto& h = delay_[c];
+        fprintf(ofile, "%-12s %10lu %10lu %10lu %10lu %10lu %10lu %10lu\n", qosName(c),
+                h.count(), h.mean(), h.percentile(50), h.percentile(99), h.max(),
+                policy[c].targetNs, late_[c]);
+    }
+}
+//=================================================================================================
@@ -0,0 +1,132 @@
+//=================================================================================================
+// RemoteServer.h - Defines a server that performs register operations on behalf of remote
+//                  pcireg clients
+//
+// Requests are scheduled by quality-of-service class, so that a client dumping thousands of
+// registers can't hold up a control loop's register write for more than a few accesses.
+//=================================================================================================
+#pragma once
+#include <unistd.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <list>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include "PciDevice.h"
+#include "RegStats.h"
+#include "RemoteProtocol.h"
+
+class RemoteServer
+{
+public:
+
+    // Constructor: 'region' is the list of mapped regions that clients may access
+    RemoteServer(const std::vector<PciDevice::resource_t>& region) : region_(region) {}
+
+    // No copy or assignment constructor - objects of this class can't be copied
+    RemoteServer (const RemoteServer&) = delete;
+    RemoteServer& operator= (const RemoteServer&) = delete;
+
+    // Accepts clients on "unix:/path" or "host:port" and serves them until stop() is called
+    void        serve(const std::string& endpoint);
+
+    // Asks serve() to return.  This is safe to call from a signal handler.
+    static void stop() {stopRequested_ = true;}
+
+    // Number of requests served so far
+    uint64_t    requests() const {return requests_;}
+
+    // Prints the queueing delay of each QoS class
+    void        report(FILE* ofile);
+
+    // How each QoS class is scheduled
+    struct policy_t
+    {
+        uint32_t budget;        // Requests a client may have performed per turn
+        uint64_t targetNs;      // Queueing delay beyond which the class jumps the queue
+    };
+    static const policy_t policy[RemoteProtocol::QOS_CLASSES];
+
+protected:
+
+    // A request waiting to be performed, and when it arrived
+    struct job_t
+    {
+        RemoteProtocol::request_t request;
+        uint64_t                  arrived;
+    };
+
+    // One connected client.  Its socket is closed when the last reference goes away.
+    struct client_t
+    {
+        int                 fd;
+        std::thread         reader;
+        bool                done = false;
+        std::deque<job_t>   queue[RemoteProtocol::QOS_CLASSES];
+        std::atomic<size_t> unanswered{0};      // Requests received but not yet answered
+        ~client_t() {if (fd >= 0) ::close(fd);}
+    };
+    typedef std::shared_ptr<client_t> clientPtr;
+
+    // A wait that hasn't been satisfied yet.  It's polled between other work.
+    struct wait_t
+    {
+        clientPtr                 client;
+        RemoteProtocol::request_t request;
+        uint64_t                  deadline;
+    };
+
+    // The body of the thread that receives one client's requests
+    void        receive(clientPtr client);
+
+    // The body of the thread that performs every request
+    void        execute();
+
+    // Chooses the class and client to serve next.  Returns false if there's nothing queued.
+    // Must be called with 'lock_' held.
+    bool        choose(int* qos, clientPtr* client);
+
+    // Polls every pending wait once, and answers those that are finished.  Returns the time at
+    // which the rest should next be polled.
+    uint64_t    pollWaits();
+
+    // Joins the threads of clients that have disconnected
+    void        reap();
+
+    // Performs one request.  Returns false if it's a wait that must be polled again.
+    bool        perform(const RemoteProtocol::request_t& request, RemoteProtocol::response_t* response);
+
+    // Sends responses to a client without blocking
+    void        reply(client_t& client, const RemoteProtocol::response_t* response, size_t count);
+
+    // The regions clients may access
+    std::vector<PciDevice::resource_t> region_;
+
+    // Every connected client
+    std::list<clientPtr>    client_;
+
+    // Per class, the clients that have requests queued, in round-robin order
+    std::deque<clientPtr>   active_[RemoteProtocol::QOS_CLASSES];
+
+    // Protects 'client_', 'active_' and each client's queues
+    std::mutex              lock_;
+    std::condition_variable wakeup_;
+    bool                    stopExecutor_ = false;
+
+    // Owned by the executor thread
+    std::vector<wait_t>     waits_;
+
+    // Per class, how long requests sat in the queue, and how many sat longer than the target
+    LatencyHistogram        delay_[RemoteProtocol::QOS_CLASSES];
+    uint64_t                late_[RemoteProtocol::QOS_CLASSES] = {};
+
+    std::atomic<uint64_t>   requests_{0};
+
+    static std::atomic<bool> stopRequested_;
+};
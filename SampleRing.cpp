@@ -0,0 +1,319 @@
+//=================================================================================================
+// SampleRing.cpp - Implements a shared-memory ring that broadcasts a sampler's sweeps to any
+//                  number of reader processes
+//=================================================================================================
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdexcept>
+#include "SampleRing.h"
+using namespace std;
+
+atomic<bool> SampleRing::stopRequested_(false);
+
+// Identifies a sample ring, and the layout of its records
+static const char     RING_MAGIC[8] = {'P','C','I','R','R','I','N','G'};
+static const uint32_t RING_VERSION  = 2;
+
+// Readers in other processes depend on this layout
+static_assert(sizeof(SampleRing::header_t)  == 128, "ring header must be 128 bytes");
+static_assert(sizeof(SampleRing::channel_t) == 64,  "ring channel entries must be 64 bytes");
+static_assert(sizeof(SampleRing::record_t)  == 64,  "ring records must be 64 bytes");
+
+
+//=================================================================================================
+// shmName() - Returns a ring name in the form that shm_open() wants, with a leading slash
+//=================================================================================================
+static string shmName(const string& name)
+{
+    return (name[0] == '/') ? name : "/" + name;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// map() - Maps the shared-memory object that's open on 'fd' and closes the descriptor
+//=================================================================================================
+void SampleRing::map(int fd, size_t size, const string& name)
+{
+    int   protection = producer_ ? PROT_READ | PROT_WRITE : PROT_READ;
+    void* ptr = mmap(0, size, protection, MAP_SHARED, fd, 0);
+
+    ::close(fd);
+
+    if (ptr == MAP_FAILED) throw runtime_error("pcireg : cant map sample ring " + name);
+
+    mapSize_ = size;
+    header_  = (header_t*)ptr;
+    table_   = (channel_t*)(header_ + 1);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// create() - Creates a ring for a set of channels, replacing any old ring of the same name
+//
+// Readers still attached to an old ring keep their mapping of it, and see that it's finished.
+//=================================================================================================
+void SampleRing::create(string name, const vector<channel_t>& channels, uint64_t capacity)
+{
+    close();
+
+    // Records are found by masking the sequence number, so the capacity is a power of 2
+    uint64_t records = 1;
+    while (records < capacity) records <<= 1;
+
+    name = shmName(name);
+    shm_unlink(name.c_str());
+
+    int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd < 0) throw runtime_error("pcireg : cant create sample ring " + name);
+
+    size_t size = sizeof(header_t) + channels.size() * sizeof(channel_t) + records * sizeof(record_t);
+    if (ftruncate(fd, size) != 0)
+    {
+        ::close(fd);
+        throw runtime_error("pcireg : cant create sample ring " + name);
+    }
+
+    producer_ = true;
+    map(fd, size, name);
+
+    // A new shared-memory object is zero-filled, so only the non-zero fields need setting
+    memcpy(header_->magic, RING_MAGIC, sizeof header_->magic);
+    header_->version     = RING_VERSION;
+    header_->recordSize  = sizeof(record_t);
+    header_->capacity    = records;
+    header_->channels    = channels.size();
+    header_->producerPid = getpid();
+    memcpy(table_, channels.data(), channels.size() * sizeof(channel_t));
+
+    ring_    = (record_t*)(table_ + channels.size());
+    mask_    = records - 1;
+    cursor_  = 0;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// open() - Opens an existing ring for reading
+//=================================================================================================
+void SampleRing::open(string name)
+{
+    struct stat sb;
+
+    close();
+
+    name = shmName(name);
+    int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0) throw runtime_error("pcireg : cant open sample ring " + name);
+
+    if (fstat(fd, &sb) != 0 || sb.st_size < (off_t)sizeof(header_t))
+    {
+        ::close(fd);
+        throw runtime_error("pcireg : " + name + " is not a pcireg sample ring");
+    }
+
+    producer_ = false;
+    map(fd, sb.st_size, name);
+
+    // Make sure it's one of ours, that records can be found by masking (the capacity is a
+    // nonzero power of 2), and that it's as big as its header says
+    uint64_t capacity = header_->capacity;
+    bool     sized    = capacity != 0 && (capacity & (capacity - 1)) == 0
+                     && capacity <= mapSize_ / sizeof(record_t)
+                     && sizeof(header_t) + header_->channels * sizeof(channel_t)
+                      + capacity * sizeof(record_t) == mapSize_;
+    if (memcmp(header_->magic, RING_MAGIC, sizeof header_->magic) != 0
+    ||  header_->version    != RING_VERSION
+    ||  header_->recordSize != sizeof(record_t)
+    ||  !sized)
+    {
+        close();
+        throw runtime_error("pcireg : " + name + " is not a pcireg sample ring");
+    }
+
+    ring_   = (record_t*)(table_ + header_->channels);
+    mask_   = header_->capacity - 1;
+    cursor_ = header_->head.load(memory_order_acquire);
+    lost_   = 0;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// close() - Unmaps the ring, telling readers first if we're the producer
+//=================================================================================================
+void SampleRing::close()
+{
+    if (header_ == nullptr) return;
+
+    if (producer_) header_->finished.store(1, memory_order_release);
+
+    munmap(header_, mapSize_);
+    header_ = nullptr;
+    table_  = nullptr;
+    ring_   = nullptr;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// publish() - Stores one sweep into the ring
+//=================================================================================================
+void SampleRing::publish(int64_t timestamp, const uint32_t* value, const vector<bool>& due)
+{
+    store(timestamp, value, due, 0);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// publishPeriods() - Stores the new periods of some adaptive channels into the ring, and into
+//                    the channel table for readers that join later
+//=================================================================================================
+void SampleRing::publishPeriods(int64_t timestamp, const uint32_t* periodUs,
+                                const vector<bool>& changed)
+{
+    for (size_t i=0; i<header_->channels; ++i)
+    {
+        if (changed[i]) __atomic_store_n(&table_[i].periodUs, periodUs[i], __ATOMIC_RELAXED);
+    }
+
+    store(timestamp, periodUs, changed, PERIODS);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// store() - Stores the records for the channels flagged in 'mask'
+//
+// Each record is marked incomplete, filled in, and published by storing its sequence number.
+// The head moves once every record is in, so readers never see part of a sweep.  The last
+// record of a sweep's values is flagged as such.
+//=================================================================================================
+void SampleRing::store(int64_t timestamp, const uint32_t* value, const vector<bool>& mask,
+                       uint8_t flags)
+{
+    size_t channels = header_->channels;
+
+    // Find the chunk of channels that holds the last flagged one, so that its record can be
+    // marked as the end of the sweep
+    size_t lastChunk = channels;
+    for (size_t i = channels; flags == 0 && i-- > 0;)
+    {
+        if (mask[i])
+        {
+            lastChunk = i - i % VALUES_PER_RECORD;
+            break;
+        }
+    }
+
+    for (size_t first = 0; first < channels; first += VALUES_PER_RECORD)
+    {
+        size_t   count = min(channels - first, (size_t)VALUES_PER_RECORD);
+        uint32_t due   = 0;
+        for (size_t n=0; n<count; ++n) if (mask[first + n]) due |= 1 << n;
+        if (due == 0) continue;
+
+        record_t& r = ring_[cursor_ & mask_];
+
+        // Mark the record as incomplete while we fill it in
+        __atomic_store_n(&r.seq, 0, __ATOMIC_RELAXED);
+        atomic_thread_fence(memory_order_release);
+
+        r.timestamp = timestamp;
+        r.first     = first;
+        r.count     = count;
+        r.flags     = (first == lastChunk) ? LAST_IN_SWEEP : flags;
+        r.due       = due;
+        memcpy(r.value, value + first, count * sizeof(uint32_t));
+
+        // And publish it
+        __atomic_store_n(&r.seq, ++cursor_, __ATOMIC_RELEASE);
+    }
+
+    header_->head.store(cursor_, memory_order_release);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// skipAhead() - Moves a cursor that the producer has lapped to the middle of what's left in the
+//               ring, which gives the reader half a ring of slack to catch up in
+//=================================================================================================
+void SampleRing::skipAhead(uint64_t head)
+{
+    uint64_t half   = header_->capacity / 2;
+    uint64_t target = (head > half) ? head - half : 0;
+    if (target <= cursor_) target = cursor_ + 1;
+    lost_  += target - cursor_;
+    cursor_ = target;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// peek() - Returns the record at the reader's cursor, or nullptr if there's nothing new
+//
+// A record whose sequence number isn't the one we expect has been overwritten, or is being
+// overwritten, so the producer has lapped us.
+//=================================================================================================
+const SampleRing::record_t* SampleRing::peek()
+{
+    while (true)
+    {
+        uint64_t head = header_->head.load(memory_order_acquire);
+        if (cursor_ >= head) return nullptr;
+
+        if (head - cursor_ > header_->capacity)
+        {
+            skipAhead(head);
+            continue;
+        }
+
+        const record_t* r = &ring_[cursor_ & mask_];
+        if (__atomic_load_n(&r->seq, __ATOMIC_ACQUIRE) == cursor_ + 1) return r;
+
+        skipAhead(header_->head.load(memory_order_acquire));
+    }
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// release() - Advances past a record, after checking that it wasn't overwritten while the
+//             caller was reading it
+//=================================================================================================
+bool SampleRing::release(const record_t* record)
+{
+    atomic_thread_fence(memory_order_acquire);
+
+    if (__atomic_load_n(&record->seq, __ATOMIC_RELAXED) == cursor_ + 1)
+    {
+        ++cursor_;
+        return true;
+    }
+
+    skipAhead(header_->head.load(memory_order_acquire));
+    return false;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// drained() - True if the producer is gone and we've read everything it published
+//
+// A producer that was killed never sets 'finished', so we also check whether it's still alive.
+//=================================================================================================
+bool SampleRing::drained()
+{
+    if (cursor_ < header_->head.load(memory_order_acquire)) return false;
+    if (header_->finished.load(memory_order_acquire)) return true;
+    return kill(header_->producerPid, 0) != 0 && errno == ESRCH;
+}
+//=================================================================================================
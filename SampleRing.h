@@ -0,0 +1,151 @@
+//=================================================================================================
+// SampleRing.h - Defines a shared-memory ring that broadcasts a sampler's sweeps to any number
+//                of reader processes
+//
+// There is one producer, the sampler, and it never waits for anyone.  It stores each sweep into
+// the next few 64-byte records of the ring and publishes each one by storing its sequence number
+// last, so publishing costs no system calls and no more with ten readers than with none.  Each
+// reader keeps its own cursor, reads records in place, and uses the sequence numbers to find out
+// whether the producer lapped it.
+//
+// An adaptive channel's period travels in-band: whenever it changes, a PERIODS record carrying
+// the new period goes out ahead of the first value read under it.  The channel table holds each
+// one's current period too, for readers that join late.
+//=================================================================================================
+#pragma once
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include <vector>
+
+class SampleRing
+{
+public:
+
+    // The number of register values that fit in a record
+    static const int VALUES_PER_RECORD = 10;
+
+    // Flag bits in a record
+    enum : uint8_t {LAST_IN_SWEEP = 1, PERIODS = 2};
+
+    // A single record: the values of up to VALUES_PER_RECORD consecutive channels, starting at
+    // 'first', from one sweep.  Bit n of 'due' is set if value[n] was read on this sweep.  'seq'
+    // is written last, and is what tells a reader that the rest of the record is complete.
+    //
+    // In a PERIODS record, value[n] is instead the new period (in microseconds) of each adaptive
+    // channel whose bit is set in 'due'.
+    struct alignas(64) record_t
+    {
+        uint64_t seq;
+        int64_t  timestamp;         // Nanoseconds since the Unix epoch
+        uint16_t first;
+        uint8_t  count;
+        uint8_t  flags;
+        uint32_t due;
+        uint32_t value[VALUES_PER_RECORD];
+    };
+
+    // The header at the start of the ring.  The second cache line is the only one the producer
+    // writes to, so readers polling 'head' don't contend with anything else.
+    struct header_t
+    {
+        char                  magic[8];
+        uint32_t              version;
+        uint32_t              recordSize;
+        uint64_t              capacity;       // Number of records the ring holds, a power of 2
+        uint32_t              channels;       // Number of entries in the channel table
+        uint32_t              producerPid;
+        uint8_t               reserved1[32];
+
+        alignas(64) std::atomic<uint64_t> head;     // Number of records ever published
+        std::atomic<uint32_t> finished;             // Set when the producer is done
+        uint8_t               reserved2[52];
+    };
+
+    // An entry in the channel table that follows the header
+    struct channel_t
+    {
+        char     name[56];
+        uint32_t axiAddr;
+        uint32_t periodUs;          // An adaptive channel's current period, or 0
+    };
+
+    // Default constructor
+    SampleRing() {}
+
+    // Destructor
+    ~SampleRing() {close();}
+
+    // No copy or assignment constructor - objects of this class can't be copied
+    SampleRing (const SampleRing&) = delete;
+    SampleRing& operator= (const SampleRing&) = delete;
+
+    // Creates a ring under a shared-memory name, replacing any old ring of that name
+    void        create(std::string name, const std::vector<channel_t>& channels,
+                       uint64_t capacity = 1 << 16);
+
+    // Opens an existing ring for reading.  The cursor starts at the newest record.
+    void        open(std::string name);
+
+    // Unmaps the ring.  If we're the producer, readers are told that there's no more to come.
+    void        close();
+
+    // True if the ring is open
+    bool        isOpen() const {return header_ != nullptr;}
+
+    // The channel table
+    const channel_t* channels()     const {return table_;}
+    uint32_t         channelCount() const {return header_->channels;}
+
+    // Producer: publishes one sweep.  Only records that hold a due channel are written.
+    void        publish(int64_t timestamp, const uint32_t* value, const std::vector<bool>& due);
+
+    // Producer: publishes new periods for the adaptive channels flagged in 'changed', and
+    // updates their entries in the channel table.  Call it before publishing the sweep whose
+    // values were read under them.
+    void        publishPeriods(int64_t timestamp, const uint32_t* periodUs,
+                               const std::vector<bool>& changed);
+
+    // Reader: returns the record at the cursor, in place, or nullptr if there isn't a new one
+    // yet.  The record must be passed to release() before its contents can be trusted.
+    const record_t* peek();
+
+    // Reader: advances past the record that peek() returned.  Returns false if the producer
+    // overwrote it while the caller was looking at it, in which case it must be discarded.
+    bool        release(const record_t* record);
+
+    // Reader: true if the producer has finished (or died) and every record has been read
+    bool        drained();
+
+    // Reader: the number of records the producer overwrote before we could read them
+    uint64_t    lost() const {return lost_;}
+
+    // Asks a reader's loop to return.  This is safe to call from a signal handler.
+    static void stop() {stopRequested_ = true;}
+    static bool stopRequested() {return stopRequested_;}
+
+protected:
+
+    // Maps the shared-memory object that's open on 'fd'
+    void        map(int fd, size_t size, const std::string& name);
+
+    // Stores the records for the channels flagged in 'mask', and moves the head past them
+    void        store(int64_t timestamp, const uint32_t* value, const std::vector<bool>& mask,
+                      uint8_t flags);
+
+    // Moves a cursor that the producer has lapped to a record that's safe to read
+    void        skipAhead(uint64_t head);
+
+    header_t*   header_   = nullptr;
+    channel_t*  table_    = nullptr;
+    record_t*   ring_     = nullptr;
+    size_t      mapSize_  = 0;
+    uint64_t    mask_     = 0;
+    bool        producer_ = false;
+
+    // The producer's count of records published; a reader's next record
+    uint64_t    cursor_   = 0;
+    uint64_t    lost_     = 0;
+
+    static std::atomic<bool> stopRequested_;
+};
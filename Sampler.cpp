@@ -0,0 +1,307 @@
+//=================================================================================================
+// Sampler.cpp - Implements a class that periodically reads a set of registers
+//=================================================================================================
+#include <time.h>
+#include <errno.h>
+#include <string.h>
+#include <numeric>
+#include <algorithm>
+#include <stdexcept>
+#include "Sampler.h"
+#include "RegAccess.h"
+using namespace std;
+
+atomic<bool> Sampler::stopRequested_(false);
+
+
+//=================================================================================================
+// clockNs() - Returns the time of the specified clock in nanoseconds
+//=================================================================================================
+static inline int64_t clockNs(clockid_t clock)
+{
+    timespec ts;
+    clock_gettime(clock, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// sleepUntil() - Sleeps until the monotonic clock reaches the specified time, or until a signal
+//                sets 'stop'
+//=================================================================================================
+static void sleepUntil(int64_t ns, const atomic<bool>& stop)
+{
+    timespec ts = {(time_t)(ns / 1000000000), (long)(ns % 1000000000)};
+
+    while (true)
+    {
+        int error = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr);
+        if (error == 0) return;
+        if (error != EINTR) throw runtime_error("pcireg : clock_nanosleep failed : " + string(strerror(error)));
+        if (stop) return;
+    }
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// tickUs() - Returns the tick period: the greatest common divisor of the channel periods, where
+//            a channel with no period of its own is sampled every 'periodUs'
+//=================================================================================================
+uint64_t Sampler::tickUs(uint64_t periodUs) const
+{
+    uint64_t tick = 0;
+    for (auto& channel : channels_) tick = gcd(tick, channel.periodUs ? channel.periodUs : periodUs);
+    return tick;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// nextDue() - Returns the first tick after 'tickNum' on which an occupied rate group has a turn
+//=================================================================================================
+uint64_t Sampler::nextDue(uint64_t tickNum) const
+{
+    uint64_t next = UINT64_MAX;
+    for (size_t g=0; g<every_.size(); ++g)
+    {
+        if ((occupied_ >> g) & 1) next = min(next, (tickNum / every_[g] + 1) * every_[g]);
+    }
+    return next;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// plan() - Returns the plan for a set of due rate groups
+//
+// The due channels are taken in address order, and each register that directly follows the
+// previous one extends the current run.  A register is read once per tick no matter how many
+// channels want it.
+//=================================================================================================
+const Sampler::plan_t& Sampler::plan(uint64_t groupMask)
+{
+    auto it = plans_.find(groupMask);
+    if (it != plans_.end()) return it->second;
+
+    plan_t& p = plans_[groupMask];
+    p.due.assign(channels_.size(), false);
+    p.slot.assign(channels_.size(), 0);
+
+    // The due channels, in address order
+    vector<size_t> order;
+    for (size_t i=0; i<channels_.size(); ++i)
+    {
+        if ((groupMask >> group_[i]) & 1) order.push_back(i);
+    }
+    sort(order.begin(), order.end(), [&](size_t a, size_t b)
+    {
+        return channels_[a].axiAddr < channels_[b].axiAddr;
+    });
+
+    for (auto i : order)
+    {
+        uint32_t addr = channels_[i].axiAddr;
+        p.due[i] = true;
+
+        // A register that's already in the last run is shared, one that follows it extends it,
+        // and anything else starts a new run
+        regRun_t* last = p.runs.empty() ? nullptr : &p.runs.back();
+        uint32_t  end  = last ? last->axiAddr + 4 * last->count : 0;
+
+        if (last && addr == end - 4)
+        {
+            p.slot[i] = p.reads - 1;
+            continue;
+        }
+
+        if (last && addr == end)
+            ++last->count;
+        else
+            p.runs.push_back({addr, 1});
+
+        p.slot[i] = p.reads++;
+    }
+
+    return p;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// groupFor() - Returns the rate group for a period of 'every' ticks
+//=================================================================================================
+int Sampler::groupFor(uint64_t every)
+{
+    auto it = find(every_.begin(), every_.end(), every);
+    if (it == every_.end()) it = every_.insert(every_.end(), every);
+    return it - every_.begin();
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// adapt() - Tracks changes to a channel that was just read and, if it's adaptive, adjusts its
+//           period: back to the shortest when the value changes, and doubled each time it has
+//           gone IDLE_READS reads without changing
+//=================================================================================================
+void Sampler::adapt(size_t channel, uint32_t value)
+{
+    state_t& state   = state_[channel];
+    bool     changed = (state.reads++ > 0 && value != state.last);
+    int      level   = state.level;
+
+    state.last = value;
+
+    if (changed)
+    {
+        ++state.changes;
+        state.idle = 0;
+        level      = 0;
+    }
+    else if (++state.idle >= IDLE_READS && level < state.maxLevel)
+    {
+        state.idle = 0;
+        ++level;
+    }
+
+    // Moving to another group changes which registers each plan reads
+    if (level != state.level)
+    {
+        state.level     = level;
+        group_[channel] = state.levelGroup[level];
+        replan_         = true;
+    }
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// run() - Ticks at a fixed rate, reads whichever channels are due, and hands each sweep to 'sink'
+//
+// Ticks are scheduled against absolute deadlines so that the rate doesn't drift.  We sleep
+// straight to the next tick on which some channel is due, so coprime periods that make for a
+// fine tick don't make for a busy loop.  If we wake late, we take the tick in progress, and
+// every channel whose turn came in the meantime is read.  Only a channel that had two or more
+// turns in that time has lost any, and those are what's counted as overruns.  Ticks on which
+// nothing was due are never counted.
+//
+// A channel with no period of its own is sampled every 'periodUs'.  If that's 0 ("as fast as
+// possible"), it can't be scheduled alongside channels that do have periods, so we throw.
+//=================================================================================================
+void Sampler::run(uint64_t periodUs, uint64_t count, sink_t sink)
+{
+    bool anyPeriod = false, anyUnset = false;
+    for (auto& channel : channels_) (channel.periodUs ? anyPeriod : anyUnset) = true;
+    if (periodUs == 0 && anyPeriod && anyUnset)
+    {
+        throw runtime_error("pcireg : registers without an @period need -period when others have one");
+    }
+
+    vector<uint32_t> value(channels_.size()), scratch(channels_.size());
+    PerfCounters     perf;
+
+    sweeps_ = overruns_ = reads_ = runs_ = 0;
+    perfTotals_ = PerfCounters::sample_t();
+    stopRequested_ = false;
+
+    if (usePerf_) perf.open();
+
+    // Sort the channels into rate groups.  Every period an adaptive channel can take gets a
+    // group up front, so that adapting is just a move from one group to another.
+    uint64_t tick = tickUs(periodUs);
+    tickUs_ = tick;
+    every_.clear();
+    group_.clear();
+    plans_.clear();
+    state_.assign(channels_.size(), state_t());
+    for (size_t i=0; i<channels_.size(); ++i)
+    {
+        auto&    channel = channels_[i];
+        auto&    state   = state_[i];
+        uint64_t every   = tick ? (channel.periodUs ? channel.periodUs : periodUs) / tick : 1;
+
+        state.levelGroup.push_back(groupFor(every));
+        if (channel.maxPeriodUs > channel.periodUs)
+        {
+            for (uint64_t p = channel.periodUs * 2; p <= channel.maxPeriodUs; p *= 2)
+            {
+                state.levelGroup.push_back(groupFor(p / tick));
+            }
+        }
+
+        state.maxLevel = state.levelGroup.size() - 1;
+        group_.push_back(state.levelGroup[0]);
+    }
+
+    if (every_.size() > 64) throw runtime_error("pcireg : too many different sampling periods");
+    replan_ = true;
+
+    int64_t  period  = tick * 1000;
+    int64_t  start   = clockNs(CLOCK_MONOTONIC);
+    uint64_t tickNum = 0, lastTick = 0;
+
+    while (!stopRequested_ && (count == 0 || sweeps_ < count))
+    {
+        // Only groups with channels in them matter.  Adapting moves channels between groups.
+        if (replan_)
+        {
+            plans_.clear();
+            occupied_ = 0;
+            for (auto g : group_) occupied_ |= 1ULL << g;
+            replan_ = false;
+        }
+
+        // Wait for the next tick on which a group is due.  The first one is right away.
+        if (sweeps_)
+        {
+            tickNum = nextDue(tickNum);
+            if (period)
+            {
+                sleepUntil(start + tickNum * period, stopRequested_);
+                if (stopRequested_) break;
+
+                // If we're running late, take the tick in progress instead
+                uint64_t nowTick = (clockNs(CLOCK_MONOTONIC) - start) / period;
+                tickNum = max(tickNum, nowTick);
+            }
+        }
+
+        // Find the groups that are due: those that have had a turn since the last tick we took.
+        // A group that has had more than one has lost the rest, and the most turns any group
+        // lost is the number of sweeps we missed.
+        uint64_t groupMask = 0, lost = 0;
+        for (size_t g=0; g<every_.size(); ++g)
+        {
+            if (((occupied_ >> g) & 1) == 0) continue;
+            uint64_t turns = (tickNum == 0) ? 1 : tickNum / every_[g] - lastTick / every_[g];
+            if (turns) groupMask |= 1ULL << g;
+            if (turns > 1) lost = max(lost, turns - 1);
+        }
+        lastTick   = tickNum;
+        overruns_ += lost;
+
+        const plan_t& p = plan(groupMask);
+
+        // Read the due registers, run by run, and give each value to its channel
+        int64_t timestamp = clockNs(CLOCK_REALTIME);
+        perf.start();
+        readRuns(baseAddr_, p.runs, scratch.data());
+        if (usePerf_) perfTotals_ += perf.stop();
+
+        for (size_t i=0; i<channels_.size(); ++i) if (p.due[i]) value[i] = scratch[p.slot[i]];
+
+        reads_ += p.reads;
+        runs_  += p.runs.size();
+
+        // Hand the results to whoever wants them, while periodUs() still reports the periods
+        // the values were read under
+        sink(timestamp, value.data(), p.due);
+        ++sweeps_;
+
+        // Then let the adaptive channels speed up or slow down
+        for (size_t i=0; i<channels_.size(); ++i) if (p.due[i]) adapt(i, value[i]);
+    }
+}
+//=================================================================================================
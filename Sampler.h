@@ -0,0 +1,150 @@
+//=================================================================================================
+// Sampler.h - Defines a class that periodically reads a set of registers
+//
+// Each register may have its own period.  The sampler ticks at the greatest common divisor of
+// the periods and, on each tick that something is due, reads only the registers that are due,
+// each exactly once, as the fewest runs of adjacent registers.  It sleeps through the ticks on
+// which nothing is due.
+//
+// A channel may instead be adaptive, with a range of periods.  It starts at the shortest, and
+// each time its value goes unchanged for IDLE_READS reads in a row its period doubles, up to
+// the longest.  As soon as the value changes, it drops back to the shortest.
+//=================================================================================================
+#pragma once
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <functional>
+#include <unordered_map>
+#include "PerfCounters.h"
+#include "RegAccess.h"
+
+class Sampler
+{
+public:
+
+    // Describes one register that gets sampled
+    struct channel_t
+    {
+        std::string name;
+        uint32_t    axiAddr;
+        uint64_t    periodUs = 0;       // 0 = the period given to run()
+        uint64_t    maxPeriodUs = 0;    // If greater than 'periodUs', the channel is adaptive
+    };
+
+    // Number of unchanged reads after which an adaptive channel's period doubles
+    static const int IDLE_READS = 4;
+
+    // Receives each sweep: a timestamp (nanoseconds since the Unix epoch), one value per channel,
+    // and which channels were read on this tick.  A channel that wasn't read keeps its last value.
+    typedef std::function<void(int64_t timestamp, const uint32_t* value,
+                               const std::vector<bool>& due)> sink_t;
+
+    // Constructor
+    Sampler(uint8_t* baseAddr, const std::vector<channel_t>& channels)
+        : baseAddr_(baseAddr), channels_(channels) {}
+
+    // Samples each channel at its own period, or every 'periodUs' microseconds if it has none,
+    // and hands each sweep to 'sink'.  If no channel has a period and 'periodUs' is 0, sweeps
+    // follow one another as fast as possible.  Returns after 'count' sweeps (0 = forever) or when
+    // stop() is called.  Throws if some channels have periods and others would need 'periodUs'
+    // but it's 0.
+    void        run(uint64_t periodUs, uint64_t count, sink_t sink);
+
+    // Returns the tick period that run() would use
+    uint64_t    tickUs(uint64_t periodUs) const;
+
+    // Asks any running sampler to return.  This is safe to call from a signal handler.
+    static void stop() {stopRequested_ = true;}
+
+    // Moves a channel to a new address, as when a new symbol file relocates its register.
+    // This may be called from within the sink.
+    void        setAddress(size_t channel, uint32_t axiAddr)
+    {
+        channels_[channel].axiAddr = axiAddr;
+        replan_ = true;
+    }
+
+    // If enabled, each sweep is wrapped in a group of CPU performance counters
+    void        enablePerf(bool flag) {usePerf_ = flag;}
+
+    // Counter totals over every sweep of the last run
+    const PerfCounters::sample_t& perfTotals() const {return perfTotals_;}
+
+    // How many sweeps were made, and how many were missed because a sweep overran (the most
+    // turns that any one channel lost)
+    uint64_t    sweeps()  const {return sweeps_;}
+    uint64_t    overruns() const {return overruns_;}
+
+    // How many registers were read, and in how many runs
+    uint64_t    reads() const {return reads_;}
+    uint64_t    runs()  const {return runs_;}
+
+    // The period a channel is being sampled at right now, in microseconds.  For an adaptive
+    // channel, this changes as the sampler runs; a sink that records it can tell which period
+    // each value was read under.
+    uint64_t    periodUs(size_t channel) const {return tickUs_ * every_[group_[channel]];}
+
+    // How many times a channel's value has been seen to change, and how many times it's been read
+    uint64_t    changes(size_t channel)   const {return state_[channel].changes;}
+    uint64_t    readCount(size_t channel) const {return state_[channel].reads;}
+
+protected:
+
+    // What to read on a tick: the runs of adjacent registers, which channels are due, and for
+    // each due channel, where its value lands among the values read
+    struct plan_t
+    {
+        std::vector<regRun_t> runs;
+        std::vector<bool>     due;
+        std::vector<size_t>   slot;
+        size_t                reads = 0;
+    };
+
+    // Returns the plan for a set of due rate groups, building it the first time it's needed
+    const plan_t& plan(uint64_t groupMask);
+
+    // Returns the rate group for a period, in ticks, creating the group if necessary
+    int         groupFor(uint64_t every);
+
+    // Returns the first tick after 'tickNum' on which an occupied rate group has a turn
+    uint64_t    nextDue(uint64_t tickNum) const;
+
+    // Speeds up or slows down an adaptive channel that was just read
+    void        adapt(size_t channel, uint32_t value);
+
+    uint8_t*                    baseAddr_;
+    std::vector<channel_t>      channels_;
+    bool                        usePerf_ = false;
+    PerfCounters::sample_t      perfTotals_;
+    uint64_t                    sweeps_ = 0, overruns_ = 0, reads_ = 0, runs_ = 0;
+
+    // Channels with the same period (in ticks) form a rate group.  'every_' holds each group's
+    // period and 'group_' each channel's group.
+    std::vector<uint64_t>       every_;
+    std::vector<int>            group_;
+    uint64_t                    tickUs_ = 0;
+
+    // What we know about each channel.  An adaptive channel's period is its shortest period
+    // times 2 to the power of 'level'.
+    struct state_t
+    {
+        uint32_t                last = 0;
+        uint64_t                reads = 0, changes = 0;
+        int                     idle = 0;
+        int                     level = 0, maxLevel = 0;
+        std::vector<int>        levelGroup;
+    };
+    std::vector<state_t>        state_;
+
+    // Plans, keyed by the mask of rate groups that are due.  They're discarded at the next tick
+    // if 'replan_' is set.
+    std::unordered_map<uint64_t, plan_t> plans_;
+    bool                        replan_ = false;
+
+    // The mask of rate groups that have channels in them
+    uint64_t                    occupied_ = 0;
+
+    static std::atomic<bool>    stopRequested_;
+};
@@ -0,0 +1,325 @@
+//=================================================================================================
+// SymbolIndex.cpp - Implements a compiled, sorted index of register and field names
+//=================================================================================================
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdexcept>
+#include <algorithm>
+#include <filesystem>
+#include "SymbolIndex.h"
+#include "SymbolTable.h"
+using namespace std;
+
+// Identifies a cached index, and its layout
+static const char     INDEX_MAGIC[8] = {'P','C','I','R','S','I','D','X'};
+static const uint32_t INDEX_VERSION  = 1;
+
+
+//=================================================================================================
+// fnv1a() - Folds a block of bytes into a 64-bit FNV-1a hash
+//=================================================================================================
+static uint64_t fnv1a(uint64_t hash, const void* data, size_t size)
+{
+    auto p = (const uint8_t*)data;
+    for (size_t i=0; i<size; ++i) hash = (hash ^ p[i]) * 0x100000001B3ULL;
+    return hash;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// stampOf() - Returns a hash of the identity, size and modification time of every symbol file,
+//             and of every directory they came from, so that any change to them changes it
+//=================================================================================================
+static uint64_t stampOf(const vector<string>& paths)
+{
+    uint64_t    hash = 0xCBF29CE484222325ULL;
+    struct stat sb;
+
+    vector<string> all = paths;
+    for (auto& filename : SymbolTable::expandPaths(paths)) all.push_back(filename);
+
+    for (auto& path : all)
+    {
+        if (stat(path.c_str(), &sb) != 0) throw runtime_error("pcireg : cant open symbol file " + path);
+
+        uint64_t fact[] = {(uint64_t)sb.st_dev, (uint64_t)sb.st_ino, (uint64_t)sb.st_size,
+                           (uint64_t)sb.st_mtim.tv_sec, (uint64_t)sb.st_mtim.tv_nsec};
+        hash = fnv1a(hash, path.data(), path.size());
+        hash = fnv1a(hash, fact, sizeof fact);
+    }
+
+    return hash;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// defaultCacheDir() - Returns the directory that indexes are cached in
+//=================================================================================================
+string SymbolIndex::defaultCacheDir()
+{
+    const char* p;
+
+    if ((p = getenv("XDG_CACHE_HOME")) && *p) return string(p) + "/pcireg";
+    if ((p = getenv("HOME")) && *p) return string(p) + "/.cache/pcireg";
+    return "/tmp/pcireg-" + to_string(getuid());
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// isPrivate() - Returns false if a cache directory is the /tmp fallback and isn't ours alone
+//
+// Anyone can create /tmp/pcireg-<uid> before we do, and then feed us a doctored index or swap
+// the cache file for a symlink.  So we create it 0700, and won't use it unless it's a real
+// directory that we own and nobody else can write to.
+//=================================================================================================
+static bool isPrivate(const string& cacheDir)
+{
+    struct stat sb;
+
+    if (cacheDir != "/tmp/pcireg-" + to_string(getuid())) return true;
+
+    mkdir(cacheDir.c_str(), 0700);
+    if (lstat(cacheDir.c_str(), &sb) != 0) return false;
+    return S_ISDIR(sb.st_mode) && sb.st_uid == getuid() && (sb.st_mode & 022) == 0;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// open() - Maps the cached index of a list of symbol files, building it if necessary
+//
+// If the cache directory can't be trusted, the index is built in memory every time.
+//=================================================================================================
+void SymbolIndex::open(const vector<string>& paths, const string& cacheDir)
+{
+    struct stat sb;
+    char        name[40];
+
+    close();
+
+    uint64_t stamp = stampOf(paths);
+
+    if (!isPrivate(cacheDir))
+    {
+        build(paths, stamp, "");
+        return;
+    }
+
+    // Each list of symbol files has its own cache file
+    uint64_t key = 0xCBF29CE484222325ULL;
+    for (auto& path : paths)
+    {
+        string full = filesystem::absolute(path).lexically_normal().string();
+        key = fnv1a(key, full.c_str(), full.size() + 1);
+    }
+    sprintf(name, "/symbols-%016lx.idx", key);
+    string filename = cacheDir + name;
+
+    // If there's a cached index and it was built from the files as they are now, use it
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd >= 0)
+    {
+        void* ptr = MAP_FAILED;
+        if (fstat(fd, &sb) == 0 && sb.st_size >= (off_t)sizeof(header_t))
+        {
+            ptr = mmap(0, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        }
+        ::close(fd);
+
+        if (ptr != MAP_FAILED)
+        {
+            // Check the sizes by subtraction, so that a crafted count or pool size can't wrap
+            auto   header = (const header_t*)ptr;
+            size_t body   = sb.st_size - sizeof(header_t);
+            if (memcmp(header->magic, INDEX_MAGIC, sizeof header->magic) == 0
+            &&  header->version  == INDEX_VERSION
+            &&  header->stamp    == stamp
+            &&  header->count    <= body / sizeof(uint32_t)
+            &&  header->poolSize == body - header->count * sizeof(uint32_t)
+            &&  isSound((const uint8_t*)ptr))
+            {
+                map_     = (const uint8_t*)ptr;
+                mapSize_ = sb.st_size;
+                attach(map_);
+                return;
+            }
+            munmap(ptr, sb.st_size);
+        }
+    }
+
+    // Otherwise, build it
+    build(paths, stamp, filename);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// build() - Loads the symbol files, builds the index image in memory, and saves it to the cache
+//
+// The cache is written to a temporary file that's renamed into place, so a concurrent query
+// never sees half an index.  If it can't be saved, we carry on with the in-memory copy.
+//=================================================================================================
+void SymbolIndex::build(const vector<string>& paths, uint64_t stamp, const string& filename)
+{
+    SymbolTable table;
+    header_t    header;
+
+    table.load(paths);
+
+    vector<string> names = table.names();
+    sort(names.begin(), names.end());
+    names.erase(unique(names.begin(), names.end()), names.end());
+
+    // Lay out the header, the offsets, and the pool
+    memset(&header, 0, sizeof header);
+    memcpy(header.magic, INDEX_MAGIC, sizeof header.magic);
+    header.version = INDEX_VERSION;
+    header.count   = names.size();
+    header.stamp   = stamp;
+    for (auto& n : names) header.poolSize += n.size() + 1;
+
+    size_t poolStart = sizeof(header_t) + names.size() * sizeof(uint32_t);
+    built_.assign(poolStart + header.poolSize, 0);
+    memcpy(built_.data(), &header, sizeof header);
+
+    auto     offset = (uint32_t*)(built_.data() + sizeof(header_t));
+    uint32_t pos    = 0;
+    for (size_t i=0; i<names.size(); ++i)
+    {
+        offset[i] = pos;
+        memcpy(built_.data() + poolStart + pos, names[i].c_str(), names[i].size() + 1);
+        pos += names[i].size() + 1;
+    }
+
+    attach(built_.data());
+
+    // Save it for next time
+    if (filename.empty()) return;
+
+    error_code ec;
+    filesystem::create_directories(filesystem::path(filename).parent_path(), ec);
+
+    string temp = filename + ".XXXXXX";
+    int fd = mkstemp(&temp[0]);
+    if (fd < 0) return;
+
+    bool ok = (write(fd, built_.data(), built_.size()) == (ssize_t)built_.size());
+    ::close(fd);
+    if (!ok || rename(temp.c_str(), filename.c_str()) != 0) unlink(temp.c_str());
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// isSound() - Returns true if every offset in an index image points into its pool, and the pool
+//             ends with a NUL, so that no name can run off the end of the image
+//
+// The image's size has already been checked against its header.
+//=================================================================================================
+bool SymbolIndex::isSound(const uint8_t* image)
+{
+    auto header = (const header_t*)image;
+    auto offset = (const uint32_t*)(image + sizeof(header_t));
+    auto pool   = (const char*)(offset + header->count);
+
+    if (header->count == 0) return true;
+    if (header->poolSize == 0 || pool[header->poolSize - 1] != 0) return false;
+
+    for (uint32_t i=0; i<header->count; ++i) if (offset[i] >= header->poolSize) return false;
+    return true;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// attach() - Points our members at the parts of an index image
+//=================================================================================================
+void SymbolIndex::attach(const uint8_t* image)
+{
+    auto header = (const header_t*)image;
+    count_  = header->count;
+    offset_ = (const uint32_t*)(image + sizeof(header_t));
+    pool_   = (const char*)(offset_ + count_);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// close() - Unmaps the index
+//=================================================================================================
+void SymbolIndex::close()
+{
+    if (map_) munmap((void*)map_, mapSize_);
+    map_    = nullptr;
+    built_.clear();
+    offset_ = nullptr;
+    pool_   = nullptr;
+    count_  = 0;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// lowerBound() - Returns the position of the first name that isn't less than 'key'
+//=================================================================================================
+size_t SymbolIndex::lowerBound(const char* key) const
+{
+    size_t lo = 0, hi = count_;
+
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        if (strcmp(name(mid), key) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// complete() - Returns the names that start with a prefix
+//
+// The matches are a contiguous run of the sorted names.  When stems are wanted, each stem is
+// followed by a jump past every name that shares it: the search key is the stem with its
+// trailing underscore bumped to the next character, which sorts just after all of them.  That
+// keeps a query's cost proportional to what it returns, rather than to what it matches.
+//=================================================================================================
+vector<string> SymbolIndex::complete(const string& prefix, bool segments) const
+{
+    vector<string> result;
+    size_t         len = prefix.size();
+
+    for (size_t i = lowerBound(prefix.c_str()); i < count_; )
+    {
+        const char* n = name(i);
+        if (strncmp(n, prefix.c_str(), len) != 0) break;
+
+        const char* underscore = segments ? strchr(n + len, '_') : nullptr;
+        if (underscore == nullptr || underscore[1] == 0)
+        {
+            result.push_back(n);
+            ++i;
+            continue;
+        }
+
+        string stem(n, underscore + 1);
+        result.push_back(stem);
+
+        stem.back() = '_' + 1;
+        i = lowerBound(stem.c_str());
+    }
+
+    return result;
+}
+//=================================================================================================
@@ -0,0 +1,83 @@
+//=================================================================================================
+// SymbolIndex.h - Defines a compiled, sorted index of register and field names that answers
+//                 name-completion queries without parsing the symbol files
+//
+// The index is built from the symbol files the first time it's needed and cached on disk, keyed
+// by the list of files.  After that, a query costs a stat() of each symbol file, an mmap() of the
+// cache, and a binary search, so shell completion stays fast even for enormous register maps.
+// The cache is rebuilt whenever a symbol file changes.
+//=================================================================================================
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+class SymbolIndex
+{
+public:
+
+    // The header at the start of a cached index.  It's followed by 'count' offsets into the
+    // name pool, in name order, and then the pool of NUL-terminated names.
+    struct header_t
+    {
+        char     magic[8];
+        uint32_t version;
+        uint32_t count;
+        uint64_t stamp;         // Identifies the versions of the symbol files it was built from
+        uint64_t poolSize;
+    };
+
+    // Default constructor
+    SymbolIndex() {}
+
+    // Destructor
+    ~SymbolIndex() {close();}
+
+    // No copy or assignment constructor - objects of this class can't be copied
+    SymbolIndex (const SymbolIndex&) = delete;
+    SymbolIndex& operator= (const SymbolIndex&) = delete;
+
+    // Opens the index of a list of symbol files and/or directories.  If the copy in 'cacheDir'
+    // is missing or out of date, the index is built from the files and the cache is replaced.
+    void        open(const std::vector<std::string>& paths, const std::string& cacheDir);
+
+    // Unmaps the index
+    void        close();
+
+    // Returns the number of names in the index
+    size_t      size() const {return count_;}
+
+    // Returns the names that start with 'prefix', in order.  If 'segments' is true, a name that
+    // goes on past the next underscore after the prefix is cut off just after that underscore,
+    // and each such stem is listed once, the way a shell completes one directory at a time.
+    std::vector<std::string> complete(const std::string& prefix, bool segments) const;
+
+    // Returns the directory that indexes are cached in
+    static std::string defaultCacheDir();
+
+protected:
+
+    // Builds the index in memory and tries to save it to 'filename', if it isn't empty
+    void        build(const std::vector<std::string>& paths, uint64_t stamp, const std::string& filename);
+
+    // Returns true if an index image's offsets and pool can be trusted
+    static bool isSound(const uint8_t* image);
+
+    // Points our members at an index image
+    void        attach(const uint8_t* image);
+
+    // Returns the position of the first name that isn't less than 'key'
+    size_t      lowerBound(const char* key) const;
+
+    // Returns a name by its position in the index
+    const char* name(size_t i) const {return pool_ + offset_[i];}
+
+    // The mapped cache file, or the image we built if it couldn't be saved
+    const uint8_t*       map_ = nullptr;
+    size_t               mapSize_ = 0;
+    std::vector<uint8_t> built_;
+
+    const uint32_t*      offset_ = nullptr;
+    const char*          pool_ = nullptr;
+    size_t               count_ = 0;
+};
@@ -0,0 +1,476 @@
+//=================================================================================================
+// SymbolTable.cpp - Implements a class that holds every register and field specifier in one or
+//                   more symbol files
+//
+// Loading happens in three steps:
+//
+//   (1) Every file is mapped into memory and cut into chunks at line boundaries
+//   (2) The chunks are parsed in parallel, each into its own list of definitions
+//   (3) The per-chunk lists are merged, in file order, into the final table.  This is where
+//       duplicate symbols, conflicting definitions, and registers that share an address are
+//       detected.
+//
+// A "#define" is taken to be a register (rather than a field or some other constant) when the
+// file labels it with a "// Register: <name>" comment.  Those labels may land in a different
+// chunk than the definition they describe, so they're collected per file and applied during
+// the merge.
+//=================================================================================================
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdexcept>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <filesystem>
+#include <unordered_set>
+#include "SymbolTable.h"
+using namespace std;
+
+// Files are split into chunks of roughly this many bytes
+static const size_t CHUNK_SIZE = 256 * 1024;
+
+// A symbol definition found while parsing
+struct definition_t
+{
+    string   name;
+    uint64_t value;
+};
+
+// A row from the "Fields:" table in a register's comment block.  'labels' is how many
+// "Register:" labels came before it in the same chunk, which tells us whose row it is.
+struct fieldRow_t
+{
+    size_t labels;
+    string name;
+    string type;
+};
+
+// A piece of a symbol file, and what was found in it
+struct chunk_t
+{
+    size_t               file;
+    const char*          begin;
+    const char*          end;
+    vector<definition_t> definition;
+    vector<string>       registerLabel;
+    vector<fieldRow_t>   fieldRow;
+};
+
+// A symbol file, mapped into memory
+struct mappedFile_t
+{
+    string      name;
+    const char* data = nullptr;
+    size_t      size = 0;
+};
+
+
+//=================================================================================================
+// is_ws() / is_eol() - Character classification for the parser
+//=================================================================================================
+static inline bool is_ws(char c)  {return c == 32 || c == 9;}
+static inline bool is_eol(char c) {return c == 10 || c == 13;}
+//=================================================================================================
+
+
+//=================================================================================================
+// nextToken() - Finds the next token on a line.  Like CTokenizer, tokens are separated by
+//               whitespace and/or a single comma
+//
+// On Entry: p   = where to start looking
+//           end = end of the line
+//
+// On Exit:  returns the start of the token (or 'end' if there isn't one), and 'tokenEnd'
+//           points just past it
+//=================================================================================================
+static inline const char* nextToken(const char* p, const char* end, const char** tokenEnd)
+{
+    while (p < end && is_ws(*p)) ++p;
+    if (p < end && *p == ',') ++p;
+    while (p < end && is_ws(*p)) ++p;
+    const char* start = p;
+    while (p < end && !is_ws(*p) && *p != ',') ++p;
+    *tokenEnd = p;
+    return start;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// parseChunk() - Parses every line in a chunk
+//
+// We're looking for three kinds of lines:
+//     #define <name> <value>
+//     // Register: <name>
+//     //     <field-name> <width> <hi:lo> <type> ...     (a row of the "Fields:" table)
+//=================================================================================================
+static void parseChunk(chunk_t& chunk)
+{
+    const char* p = chunk.begin;
+
+    while (p < chunk.end)
+    {
+        // Find the end of this line
+        const char* eol = (const char*)memchr(p, '\n', chunk.end - p);
+        if (eol == nullptr) eol = chunk.end;
+        const char* lineEnd = eol;
+        while (lineEnd > p && is_eol(lineEnd[-1])) --lineEnd;
+
+        const char *tokenEnd, *token = nextToken(p, lineEnd, &tokenEnd);
+        size_t      len = tokenEnd - token;
+
+        // Is this a "#define <name> <value>" line?
+        if (len == 7 && memcmp(token, "#define", 7) == 0)
+        {
+            const char *nameEnd,  *name  = nextToken(tokenEnd, lineEnd, &nameEnd);
+            const char *valueEnd, *value = nextToken(nameEnd,  lineEnd, &valueEnd);
+            const char *restEnd,  *rest  = nextToken(valueEnd, lineEnd, &restEnd);
+
+            // Only lines with exactly three tokens are symbol definitions
+            if (name < nameEnd && value < valueEnd && rest == restEnd)
+            {
+                string text(value, valueEnd);
+                chunk.definition.push_back({string(name, nameEnd), strtoull(text.c_str(), nullptr, 0)});
+            }
+        }
+
+        // Is this a "// Register: <name>" comment?
+        else if (len == 2 && memcmp(token, "//", 2) == 0)
+        {
+            const char *labelEnd, *label = nextToken(tokenEnd, lineEnd, &labelEnd);
+            if (labelEnd - label == 9 && memcmp(label, "Register:", 9) == 0)
+            {
+                const char *nameEnd, *name = nextToken(labelEnd, lineEnd, &nameEnd);
+                if (name < nameEnd) chunk.registerLabel.push_back(string(name, nameEnd));
+            }
+
+            // A field row has a numeric width, then a bit position, then an access type
+            else if (labelEnd > label)
+            {
+                const char *widthEnd, *width = nextToken(labelEnd, lineEnd, &widthEnd);
+                const char *posEnd,   *pos   = nextToken(widthEnd, lineEnd, &posEnd);
+                const char *typeEnd,  *type  = nextToken(posEnd,   lineEnd, &typeEnd);
+
+                bool isRow = (width < widthEnd && pos < posEnd && type < typeEnd);
+                for (const char* p = width; isRow && p < widthEnd; ++p) isRow = (*p >= '0' && *p <= '9');
+                for (const char* p = pos;   isRow && p < posEnd;   ++p) isRow = (*p >= '0' && *p <= '9') || *p == ':';
+                for (const char* p = type;  isRow && p < typeEnd;  ++p) isRow = (*p >= 'A' && *p <= 'Z') || (*p >= '0' && *p <= '9');
+
+                if (isRow)
+                {
+                    chunk.fieldRow.push_back({chunk.registerLabel.size(), string(label, labelEnd),
+                                              string(type, typeEnd)});
+                }
+            }
+        }
+
+        p = eol + 1;
+    }
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// expandPaths() - Turns a list of files and directories into a list of files.  Directories
+//                 contribute every ".h" file in them, in name order.
+//=================================================================================================
+vector<string> SymbolTable::expandPaths(const vector<string>& paths)
+{
+    vector<string> result;
+
+    for (auto& path : paths)
+    {
+        if (!filesystem::is_directory(path))
+        {
+            result.push_back(path);
+            continue;
+        }
+
+        vector<string> headers;
+        for (auto const& entry : filesystem::directory_iterator(path))
+        {
+            if (entry.is_regular_file() && entry.path().extension() == ".h")
+            {
+                headers.push_back(entry.path().string());
+            }
+        }
+
+        sort(headers.begin(), headers.end());
+        result.insert(result.end(), headers.begin(), headers.end());
+    }
+
+    return result;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// mapFile() - Maps a symbol file into memory
+//=================================================================================================
+static mappedFile_t mapFile(const string& filename)
+{
+    mappedFile_t file;
+    struct stat  sb;
+
+    file.name = filename;
+
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) throw runtime_error("pcireg : cant open symbol file " + filename);
+
+    fstat(fd, &sb);
+    file.size = sb.st_size;
+
+    // An empty file is legal, it just doesn't define anything
+    if (file.size)
+    {
+        void* ptr = mmap(0, file.size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (ptr == MAP_FAILED)
+        {
+            ::close(fd);
+            throw runtime_error("pcireg : cant map symbol file " + filename);
+        }
+        file.data = (const char*)ptr;
+    }
+
+    ::close(fd);
+    return file;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// load() - Loads and merges a list of symbol files and/or directories of symbol files
+//
+// Throws if a file can't be read.  A symbol that two files give different values keeps its first
+// definition, and that, like registers from different files that share an address, is reported
+// through warnings().
+//=================================================================================================
+void SymbolTable::load(const vector<string>& paths, int threads)
+{
+    vector<mappedFile_t> file;
+    vector<chunk_t>      chunk;
+
+    clear();
+
+    // Map every file into memory
+    try
+    {
+        for (auto& filename : expandPaths(paths)) file.push_back(mapFile(filename));
+    }
+    catch (...)
+    {
+        for (auto& f : file) if (f.data) munmap((void*)f.data, f.size);
+        throw;
+    }
+
+    // Cut each file into chunks that end on line boundaries
+    for (size_t f=0; f<file.size(); ++f)
+    {
+        const char* p   = file[f].data;
+        const char* end = p + file[f].size;
+
+        while (p < end)
+        {
+            const char* chunkEnd = (end - p > (ptrdiff_t)CHUNK_SIZE) ? p + CHUNK_SIZE : end;
+            while (chunkEnd < end && chunkEnd[-1] != '\n') ++chunkEnd;
+            chunk.push_back({f, p, chunkEnd, {}, {}, {}});
+            p = chunkEnd;
+        }
+    }
+
+    // Parse the chunks in parallel.  Each thread takes the next unparsed chunk until none remain
+    if (threads <= 0) threads = max(1U, thread::hardware_concurrency());
+    threads = max(1, min(threads, (int)chunk.size()));
+
+    atomic<size_t> next(0);
+    auto worker = [&]()
+    {
+        for (size_t c = next++; c < chunk.size(); c = next++) parseChunk(chunk[c]);
+    };
+
+    vector<thread> pool;
+    for (int t=1; t<threads; ++t) pool.emplace_back(worker);
+    worker();
+    for (auto& t : pool) t.join();
+
+    // We're done with the file contents
+    for (auto& f : file) if (f.data) munmap((void*)f.data, f.size);
+
+    // Find out which names each file labels as registers
+    vector<unordered_set<string>> label(file.size());
+    for (auto& c : chunk) label[c.file].insert(c.registerLabel.begin(), c.registerLabel.end());
+
+    // Find the access type of each field.  A row belongs to the register labeled most recently,
+    // which may have been in an earlier chunk of the same file.
+    unordered_map<string, string> fieldType;
+    string                        lastLabel;
+    for (size_t i=0; i<chunk.size(); ++i)
+    {
+        auto& c = chunk[i];
+        if (i > 0 && chunk[i - 1].file != c.file) lastLabel.clear();
+
+        for (auto& row : c.fieldRow)
+        {
+            const string& owner = row.labels ? c.registerLabel[row.labels - 1] : lastLabel;
+            if (!owner.empty()) fieldType[owner + "_" + row.name] = row.type;
+        }
+
+        if (!c.registerLabel.empty()) lastLabel = c.registerLabel.back();
+    }
+
+    // Merge the definitions, keeping track of which file each symbol came from
+    unordered_map<string, size_t> origin;
+    map<uint32_t, size_t>         regOrigin;
+    map<uint32_t, string>         unlabeled;
+    vector<definition_t>          fieldCandidate;
+    bool                          anyLabels = false;
+
+    for (auto& c : chunk)
+    {
+        const string& filename = file[c.file].name;
+        anyLabels |= !label[c.file].empty();
+
+        for (auto& d : c.definition)
+        {
+            // Have we seen this symbol before?
+            auto it = value_.find(d.name);
+            if (it != value_.end())
+            {
+                // A repeated definition with the same value is harmless
+                if (it->second == d.value) continue;
+
+                // One with a different value is worth telling the user about.  The first one wins.
+                warning_.push_back("pcireg : " + d.name + " has conflicting definitions in "
+                                   + file[origin[d.name]].name + " and " + filename
+                                   + ", using the first");
+                continue;
+            }
+
+            value_[d.name] = d.value;
+            origin[d.name] = c.file;
+
+            uint32_t addr = (uint32_t)d.value;
+
+            // If it isn't labeled as a register, it's either a field or something we'll need
+            // if nothing is labeled
+            if (label[c.file].count(d.name) == 0)
+            {
+                if (d.value >> 32) fieldCandidate.push_back(d);
+                else if (unlabeled.count(addr) == 0) unlabeled[addr] = d.name;
+                continue;
+            }
+
+            // Two different registers at the same address is worth telling the user about
+            auto reg = regName_.find(addr);
+            if (reg != regName_.end())
+            {
+                char text[40];
+                sprintf(text, "0x%08X", addr);
+                warning_.push_back("pcireg : " + reg->second + " (" + file[regOrigin[addr]].name
+                                   + ") and " + d.name + " (" + filename + ") share address " + text);
+                continue;
+            }
+
+            regName_[addr]   = d.name;
+            regOrigin[addr]  = c.file;
+        }
+    }
+
+    // If none of the files labeled their registers, use our best guess
+    if (!anyLabels) regName_ = unlabeled;
+
+    // A field belongs to a register when it has the register's address, and its name is the
+    // register's name followed by an underscore
+    for (auto& d : fieldCandidate)
+    {
+        auto reg = regName_.find((uint32_t)d.value);
+        if (reg == regName_.end()) continue;
+
+        const string& regName = reg->second;
+        if (d.name.size() <= regName.size() + 1) continue;
+        if (d.name.compare(0, regName.size(), regName) != 0 || d.name[regName.size()] != '_') continue;
+
+        auto type = fieldType.find(d.name);
+        field_[reg->first].push_back({d.name.substr(regName.size() + 1), (uint32_t)(d.value >> 32),
+                                      type == fieldType.end() ? "" : type->second});
+    }
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// find() - Looks up the value of a symbol.  Returns false if the symbol doesn't exist
+//=================================================================================================
+bool SymbolTable::find(const string& name, uint64_t* value) const
+{
+    auto it = value_.find(name);
+    if (it == value_.end()) return false;
+    *value = it->second;
+    return true;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// fields() - Returns the fields of the register at the specified address
+//=================================================================================================
+const vector<SymbolTable::field_t>& SymbolTable::fields(uint32_t axiAddr) const
+{
+    static const vector<field_t> none;
+    auto it = field_.find(axiAddr);
+    return (it == field_.end()) ? none : it->second;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// isReadSafe() - Returns true if reading the register at the specified address has no side
+//                effects.  That's known only when every one of its fields has an access type
+//                that is unaffected by a read.
+//=================================================================================================
+bool SymbolTable::isReadSafe(uint32_t axiAddr) const
+{
+    static const unordered_set<string> safe = {"RO", "RW", "RW1C", "RW1S"};
+
+    auto& list = fields(axiAddr);
+    if (list.empty()) return false;
+
+    for (auto& field : list) if (safe.count(field.type) == 0) return false;
+    return true;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// names() - Returns the full name of every register and every field
+//=================================================================================================
+vector<string> SymbolTable::names() const
+{
+    vector<string> result;
+
+    for (auto& reg : regName_) result.push_back(reg.second);
+
+    for (auto& list : field_)
+    {
+        string regName = nameOf(list.first);
+        for (auto& field : list.second) result.push_back(regName + "_" + field.name);
+    }
+
+    return result;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// nameOf() - Returns the name of the register at the specified address, or "" if unknown
+//=================================================================================================
+string SymbolTable::nameOf(uint32_t axiAddr) const
+{
+    auto it = regName_.find(axiAddr);
+    return (it == regName_.end()) ? "" : it->second;
+}
+//=================================================================================================
@@ -0,0 +1,75 @@
+//=================================================================================================
+// SymbolTable.h - Defines a class that holds every register and field specifier in one or more
+//                 symbol files
+//=================================================================================================
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+
+class SymbolTable
+{
+public:
+
+    // A bit-field within a register
+    struct field_t
+    {
+        std::string name;       // The name of the field, without the register name in front
+        uint32_t    fieldSpec;  // The upper 32 bits of the field specifier
+        std::string type;       // The access type ("RO", "RW", "RW1C", ...), if the file says
+    };
+
+    // Loads every "#define <name> <value>" line from a symbol file
+    void        load(std::string filename) {load(std::vector<std::string>{filename});}
+
+    // Loads and merges a list of symbol files and/or directories of symbol files.  Large files
+    // are split at line boundaries and parsed on 'threads' threads (0 = one per CPU).
+    void        load(const std::vector<std::string>& paths, int threads = 0);
+
+    // Empties the table
+    void        clear() {value_.clear(); regName_.clear(); field_.clear(); warning_.clear();}
+
+    // Looks up a symbol.  Returns false if it doesn't exist
+    bool        find(const std::string& name, uint64_t* value) const;
+
+    // Returns the name of the register at the specified address, or "" if there isn't one
+    std::string nameOf(uint32_t axiAddr) const;
+
+    // Returns the map of register addresses to register names
+    const std::map<uint32_t, std::string>& registers() const {return regName_;}
+
+    // Returns the fields of the register at the specified address, in symbol file order
+    const std::vector<field_t>& fields(uint32_t axiAddr) const;
+
+    // Returns true if reading the register at the specified address is known to have no side
+    // effects, judging by the access types of its fields
+    bool        isReadSafe(uint32_t axiAddr) const;
+
+    // Returns the number of symbols in the table
+    size_t      size() const {return value_.size();}
+
+    // Returns the full name of every register and every field, in no particular order
+    std::vector<std::string> names() const;
+
+    // Turns a list of files and directories into the list of symbol files that load() reads
+    static std::vector<std::string> expandPaths(const std::vector<std::string>& paths);
+
+    // Problems found while merging files that weren't serious enough to fail the load
+    const std::vector<std::string>& warnings() const {return warning_;}
+
+protected:
+
+    // Maps symbol names to their 64-bit values
+    std::unordered_map<std::string, uint64_t> value_;
+
+    // Maps register addresses to register names.  Field specifiers don't appear here.
+    std::map<uint32_t, std::string> regName_;
+
+    // Maps register addresses to the fields within those registers
+    std::map<uint32_t, std::vector<field_t>> field_;
+
+    // Non-fatal problems found during the last load
+    std::vector<std::string> warning_;
+};
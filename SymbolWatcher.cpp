@@ -0,0 +1,270 @@
+//=================================================================================================
+// SymbolWatcher.cpp - Implements a class that keeps a symbol table up to date as its files change
+//
+// The directories that hold the symbol files are watched with inotify (watching the directory
+// rather than the file catches editors and build tools that replace a file by renaming a new
+// one over it).  After a burst of changes has been quiet for a moment, the files are loaded
+// into a new table on the background thread, and the new table is swapped in with a single
+// atomic store.  If the load fails, the old table stays in place.
+//
+// Reclamation is epoch-based, RCU style:
+//   - A reader claims a slot and records the global epoch in it, then loads the table pointer.
+//   - The writer swaps the pointer, then advances the epoch.  The old table is retired with the
+//     new epoch number.
+//   - A retired table is deleted once every occupied slot holds an epoch at least that new.
+//     Any reader still using the old table must have recorded an older epoch, so the table
+//     lives until that reader has gone.
+//
+// Readers never wait on the writer, and the writer never waits on readers.
+//=================================================================================================
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <poll.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/inotify.h>
+#include <filesystem>
+#include <stdexcept>
+#include <algorithm>
+#include "SymbolWatcher.h"
+using namespace std;
+
+// How long the files must be left alone before we reload them, in milliseconds
+static const int SETTLE_MS = 200;
+
+// A watched directory, and the names in it that matter ("" = any ".h" file)
+struct watch_t
+{
+    int    wd;
+    string name;
+};
+
+
+//=================================================================================================
+// Constructor - Starts with no table and no readers
+//=================================================================================================
+SymbolWatcher::SymbolWatcher() : current_(nullptr), epoch_(1), generation_(0)
+{
+    for (auto& slot : slot_) slot.epoch = 0;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// Destructor - Stops the background thread and deletes every table.  There must be no Readers.
+//=================================================================================================
+SymbolWatcher::~SymbolWatcher()
+{
+    stop();
+    for (auto& r : retired_) delete r.table;
+    delete current_.load();
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// Reader - Claims a slot, records the epoch in it, and only then fetches the table pointer
+//=================================================================================================
+SymbolWatcher::Reader::Reader(SymbolWatcher& watcher) : watcher_(watcher)
+{
+    while (true)
+    {
+        for (slot_ = 0; slot_ < MAX_READERS; ++slot_)
+        {
+            uint64_t expected = 0;
+            uint64_t epoch    = watcher_.epoch_.load();
+            if (watcher_.slot_[slot_].epoch.compare_exchange_strong(expected, epoch))
+            {
+                table_ = watcher_.current_.load();
+                return;
+            }
+        }
+
+        // Every slot is busy.  This doesn't happen unless there are dozens of readers.
+        this_thread::yield();
+    }
+}
+
+SymbolWatcher::Reader::~Reader()
+{
+    watcher_.slot_[slot_].epoch.store(0);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// start() - Installs the initial table and starts watching the symbol files for changes
+//=================================================================================================
+void SymbolWatcher::start(const vector<string>& paths, int threads, const SymbolTable& initial)
+{
+    stop();
+
+    paths_   = paths;
+    threads_ = threads;
+    delete current_.exchange(new SymbolTable(initial));
+
+    inotify_ = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+    if (inotify_ < 0) throw runtime_error("pcireg : cant initialize inotify");
+
+    if (pipe(wakeup_) < 0) throw runtime_error("pcireg : cant create pipe");
+
+    // The thread is started with every signal blocked, so that signals meant to interrupt the
+    // main thread (Ctrl-C, etc) are never delivered here instead
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    thread_ = thread(&SymbolWatcher::watch, this);
+    pthread_sigmask(SIG_SETMASK, &old, nullptr);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// stop() - Stops the background thread.  The current table stays available to readers.
+//=================================================================================================
+void SymbolWatcher::stop()
+{
+    if (thread_.joinable())
+    {
+        if (write(wakeup_[1], "x", 1) < 0) perror("pcireg");
+        thread_.join();
+    }
+
+    if (inotify_   >= 0) close(inotify_);
+    if (wakeup_[0] >= 0) close(wakeup_[0]);
+    if (wakeup_[1] >= 0) close(wakeup_[1]);
+    inotify_ = wakeup_[0] = wakeup_[1] = -1;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// watch() - The body of the background thread.  Waits for changes to the symbol files, and
+//           reloads them once they've settled.
+//=================================================================================================
+void SymbolWatcher::watch()
+{
+    vector<watch_t> watched;
+    const uint32_t  mask = IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_CREATE | IN_DELETE;
+
+    // Watch each directory, or the directory that holds each file
+    for (auto& path : paths_)
+    {
+        filesystem::path p(path);
+        bool   isDir = filesystem::is_directory(p);
+        string dir   = isDir ? path : p.parent_path().string();
+        if (dir.empty()) dir = ".";
+
+        int wd = inotify_add_watch(inotify_, dir.c_str(), mask);
+        if (wd < 0)
+        {
+            fprintf(stderr, "pcireg : cant watch %s for changes\n", dir.c_str());
+            continue;
+        }
+
+        watched.push_back({wd, isDir ? "" : p.filename().string()});
+    }
+
+    bool pending = false;
+
+    while (true)
+    {
+        pollfd fds[2] = {{inotify_, POLLIN, 0}, {wakeup_[0], POLLIN, 0}};
+
+        // If there's a change waiting to settle, wait only a short time for more
+        int ready = poll(fds, 2, pending ? SETTLE_MS : 1000);
+
+        // Time to quit?
+        if (fds[1].revents) break;
+
+        // If nothing happened, either the changes have settled or we're just idle
+        if (ready == 0)
+        {
+            if (pending) reload();
+            pending = false;
+            reclaim();
+            continue;
+        }
+
+        // Find out whether any of the events concern our files
+        alignas(inotify_event) char buffer[16 * 1024];
+        ssize_t length;
+        while ((length = read(inotify_, buffer, sizeof(buffer))) > 0)
+        {
+            for (char* p = buffer; p < buffer + length; )
+            {
+                auto&  event = *(inotify_event*)p;
+                string name  = event.len ? event.name : "";
+                p += sizeof(inotify_event) + event.len;
+
+                for (auto& w : watched)
+                {
+                    if (w.wd != event.wd) continue;
+                    if (w.name.empty() ? filesystem::path(name).extension() == ".h" : name == w.name)
+                    {
+                        pending = true;
+                    }
+                }
+            }
+        }
+    }
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// reload() - Loads the symbol files into a new table and swaps it in
+//=================================================================================================
+void SymbolWatcher::reload()
+{
+    SymbolTable* table = new SymbolTable;
+
+    try
+    {
+        table->load(paths_, threads_);
+    }
+    catch (const std::exception& e)
+    {
+        fprintf(stderr, "%s (keeping the previous symbols)\n", e.what());
+        delete table;
+        return;
+    }
+
+    for (auto& warning : table->warnings()) fprintf(stderr, "%s\n", warning.c_str());
+
+    // Swap the new table in, then start a new epoch.  Readers that started before this point
+    // may still be using the old table.
+    const SymbolTable* old = current_.exchange(table);
+    uint64_t epoch = ++epoch_;
+    retired_.push_back({old, epoch});
+    ++generation_;
+
+    fprintf(stderr, "pcireg : reloaded %lu symbols\n", table->size());
+
+    reclaim();
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// reclaim() - Deletes every retired table that no reader can still be using
+//=================================================================================================
+void SymbolWatcher::reclaim()
+{
+    if (retired_.empty()) return;
+
+    // Find the oldest epoch that any reader is in
+    uint64_t oldest = UINT64_MAX;
+    for (auto& slot : slot_)
+    {
+        uint64_t epoch = slot.epoch.load();
+        if (epoch) oldest = std::min(oldest, epoch);
+    }
+
+    // A table retired in epoch 'e' is unreachable once every reader started in 'e' or later
+    auto unused = [&](const retired_t& r) {return r.epoch <= oldest;};
+    for (auto& r : retired_) if (unused(r)) delete r.table;
+    retired_.erase(remove_if(retired_.begin(), retired_.end(), unused), retired_.end());
+}
+//=================================================================================================
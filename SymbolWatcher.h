@@ -0,0 +1,97 @@
+//=================================================================================================
+// SymbolWatcher.h - Defines a class that keeps a symbol table up to date as its files change
+//
+// Long-running modes read the current table through a Reader:
+//
+//     SymbolWatcher::Reader symbols(watcher);
+//     symbols->find(name, &value);
+//
+// Readers never block.  When a symbol file changes, a background thread loads a new table and
+// swaps it in; the old table is deleted only after every Reader that might still be using it
+// has gone away.
+//=================================================================================================
+#pragma once
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <thread>
+#include "SymbolTable.h"
+
+class SymbolWatcher
+{
+public:
+
+    // Constructor and destructor
+    SymbolWatcher();
+    ~SymbolWatcher();
+
+    // No copy or assignment constructor - objects of this class can't be copied
+    SymbolWatcher (const SymbolWatcher&) = delete;
+    SymbolWatcher& operator= (const SymbolWatcher&) = delete;
+
+    // Starts watching the specified symbol files and/or directories.  'initial' is the table
+    // that was loaded from them, and is what readers see until the first change.
+    void        start(const std::vector<std::string>& paths, int threads, const SymbolTable& initial);
+
+    // Stops watching
+    void        stop();
+
+    // Counts the reloads that have been swapped in.  Cheap enough to check on every request.
+    uint64_t    generation() const {return generation_;}
+
+    // Grants access to the current table for as long as it exists
+    class Reader
+    {
+    public:
+        Reader(SymbolWatcher& watcher);
+        ~Reader();
+        Reader (const Reader&) = delete;
+        Reader& operator= (const Reader&) = delete;
+
+        const SymbolTable* operator->() const {return table_;}
+        const SymbolTable& operator* () const {return *table_;}
+
+    protected:
+        SymbolWatcher&     watcher_;
+        int                slot_;
+        const SymbolTable* table_;
+    };
+
+protected:
+
+    // The body of the background thread
+    void        watch();
+
+    // Loads the symbol files and, if that works, swaps the new table in
+    void        reload();
+
+    // Deletes retired tables that no reader can still be using
+    void        reclaim();
+
+    // The files we load, and the threads we load them with
+    std::vector<std::string> paths_;
+    int                      threads_ = 0;
+
+    // The current table
+    std::atomic<const SymbolTable*> current_;
+
+    // The global epoch advances every time a table is retired
+    std::atomic<uint64_t>    epoch_;
+
+    // Each active reader holds a slot containing the epoch it started in (0 = slot is free)
+    static const int MAX_READERS = 64;
+    struct alignas(64) slot_t {std::atomic<uint64_t> epoch;};
+    slot_t                   slot_[MAX_READERS];
+
+    // Tables that have been swapped out, and the epoch in which they were
+    struct retired_t {const SymbolTable* table; uint64_t epoch;};
+    std::vector<retired_t>   retired_;
+
+    std::atomic<uint64_t>    generation_;
+
+    // The inotify descriptor, a pipe that wakes the thread up to stop, and the thread
+    int                      inotify_ = -1;
+    int                      wakeup_[2] = {-1, -1};
+    std::thread              thread_;
+};
@@ -0,0 +1,249 @@
+//=================================================================================================
+// TSQuery.cpp - Implements a multi-threaded query over a time-series file
+//
+// The blocks that overlap the time window are divided into contiguous ranges, one per thread.
+// Each thread produces a partial result per series, and the partial results are then merged in
+// block order so that changes and counter increases across range boundaries are accounted for.
+//
+// Blocks are decoded only when they have to be:
+//   - Blocks entirely outside the window are never looked at.
+//   - A column that doesn't change within a block is handled as a run of a single value.
+//   - If percentiles aren't wanted, a whole-register series in a block that lies entirely
+//     inside the window is answered from the block index alone.
+//=================================================================================================
+#include <thread>
+#include <algorithm>
+#include "TSQuery.h"
+using namespace std;
+
+// The partial result for one series over a contiguous range of blocks
+struct partial_t
+{
+    bool             any = false;
+    uint64_t         samples = 0;
+    uint32_t         min = 0, max = 0, first = 0, last = 0;
+    uint64_t         changes = 0, increase = 0;
+    int64_t          tsFirst = 0, tsLast = 0;
+    LatencyHistogram histogram;
+};
+
+
+//=================================================================================================
+// fieldMask() - Returns the mask of valid bits for a series' values
+//=================================================================================================
+static inline uint32_t fieldMask(uint32_t fieldSpec)
+{
+    uint32_t width = (fieldSpec >> 24) & 0xFF;
+    return (fieldSpec == 0 || width >= 32) ? 0xFFFFFFFF : (1U << width) - 1;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// project() - Extracts a series' field from a register value
+//=================================================================================================
+static inline uint32_t project(uint32_t value, uint32_t fieldSpec)
+{
+    if (fieldSpec == 0) return value;
+    uint32_t pos = (fieldSpec >> 16) & 0xFF;
+    return (value >> pos) & fieldMask(fieldSpec);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// addRun() - Adds 'count' consecutive samples of the same value to a partial result
+//=================================================================================================
+static void addRun(partial_t& p, uint32_t value, uint64_t count, int64_t tsFirst, int64_t tsLast,
+                   uint32_t mask, bool percentiles)
+{
+    if (!p.any)
+    {
+        p.any     = true;
+        p.first   = p.last = p.min = p.max = value;
+        p.tsFirst = tsFirst;
+    }
+    else if (value != p.last)
+    {
+        ++p.changes;
+        p.increase += (value - p.last) & mask;
+        p.last = value;
+        p.min  = std::min(p.min, value);
+        p.max  = std::max(p.max, value);
+    }
+
+    p.samples += count;
+    p.tsLast   = tsLast;
+    if (percentiles) p.histogram.record(value, count);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// addSummary() - Adds an entire block of a whole-register column to a partial result, using
+//                nothing but the block index
+//
+// The counter increase within the block is taken to be (last - first), which is exact unless a
+// counter wraps more than once within a single block
+//=================================================================================================
+static void addSummary(partial_t& p, const TSStore::colIndex_t& col, uint32_t rows,
+                       int64_t tsFirst, int64_t tsLast)
+{
+    addRun(p, col.first, 1, tsFirst, tsFirst, 0xFFFFFFFF, false);
+
+    p.samples  += rows - 1;
+    p.changes  += col.changes;
+    p.increase += (uint32_t)(col.last - col.first);
+    p.min       = std::min(p.min, col.min);
+    p.max       = std::max(p.max, col.max);
+    p.last      = col.last;
+    p.tsLast    = tsLast;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// merge() - Folds the partial result for a later range of blocks into an earlier one
+//=================================================================================================
+static void merge(partial_t& a, const partial_t& b, uint32_t mask)
+{
+    if (!b.any) return;
+
+    if (!a.any)
+    {
+        a = b;
+        return;
+    }
+
+    a.changes  += b.changes  + (b.first != a.last);
+    a.increase += b.increase + ((b.first - a.last) & mask);
+    a.samples  += b.samples;
+    a.min       = std::min(a.min, b.min);
+    a.max       = std::max(a.max, b.max);
+    a.last      = b.last;
+    a.tsLast    = b.tsLast;
+    a.histogram.merge(b.histogram);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// scanBlocks() - Computes partial results for every series over a range of blocks
+//=================================================================================================
+static void scanBlocks(const TSReader& reader, const vector<TSQuery::series_t>& series,
+                       const vector<size_t>& blocks, size_t begin, size_t end,
+                       int64_t fromNs, int64_t toNs, bool percentiles, vector<partial_t>& out)
+{
+    vector<int64_t>        timestamp;
+    vector<uint32_t>       value;
+    vector<const uint8_t*> start;
+
+    out.assign(series.size(), partial_t());
+
+    for (size_t b = begin; b < end; ++b)
+    {
+        const auto& block = reader.index()[blocks[b]];
+
+        // Is this block entirely inside the time window?
+        bool inside = (fromNs <= block.tsFirst && block.tsLast <= toNs);
+
+        // If not, we need its timestamps to know which rows count
+        if (!inside) reader.decodeTimestamps(blocks[b], timestamp);
+
+        // The columns are found the first time one has to be decoded
+        start.clear();
+
+        for (size_t s=0; s<series.size(); ++s)
+        {
+            const auto& col  = block.col[series[s].column];
+            uint32_t    spec = series[s].fieldSpec;
+            uint32_t    mask = fieldMask(spec);
+            partial_t&  p    = out[s];
+
+            // A whole-register series can come straight from the index
+            if (inside && spec == 0 && !percentiles)
+            {
+                addSummary(p, col, block.rows, block.tsFirst, block.tsLast);
+                continue;
+            }
+
+            // So can a column that never changes within the block
+            if (inside && col.changes == 0)
+            {
+                addRun(p, project(col.first, spec), block.rows, block.tsFirst, block.tsLast,
+                       mask, percentiles);
+                continue;
+            }
+
+            // Otherwise, we have to decode the column
+            if (start.empty()) reader.locateColumns(blocks[b], start);
+            reader.decodeColumn(blocks[b], start[series[s].column], value);
+
+            for (size_t i=0; i<block.rows; ++i)
+            {
+                int64_t ts = inside ? (i == 0 ? block.tsFirst : block.tsLast) : timestamp[i];
+                if (ts < fromNs || ts > toNs) continue;
+                addRun(p, project(value[i], spec), 1, ts, ts, mask, percentiles);
+            }
+        }
+    }
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// run() - Computes statistics for each series over the window [fromNs, toNs]
+//=================================================================================================
+vector<TSQuery::result_t> TSQuery::run(const TSReader& reader, const vector<series_t>& series,
+                                       int64_t fromNs, int64_t toNs, int threads, bool percentiles)
+{
+    vector<size_t> blocks;
+
+    // Find the blocks that overlap the time window
+    for (size_t b=0; b<reader.index().size(); ++b)
+    {
+        const auto& block = reader.index()[b];
+        if (block.tsLast >= fromNs && block.tsFirst <= toNs) blocks.push_back(b);
+    }
+
+    // There's no point in having more threads than blocks
+    threads = std::max(1, std::min(threads, (int)blocks.size()));
+
+    // Give each thread a contiguous range of blocks to scan
+    vector<vector<partial_t>> partial(threads);
+    vector<thread>            worker;
+    for (int t=0; t<threads; ++t)
+    {
+        size_t begin = blocks.size() *  t      / threads;
+        size_t end   = blocks.size() * (t + 1) / threads;
+        worker.emplace_back(scanBlocks, cref(reader), cref(series), cref(blocks), begin, end,
+                            fromNs, toNs, percentiles, ref(partial[t]));
+    }
+
+    // Wait for all of them to finish
+    for (auto& w : worker) w.join();
+
+    // Merge the partial results in block order
+    vector<result_t> result(series.size());
+    for (size_t s=0; s<series.size(); ++s)
+    {
+        partial_t total;
+        for (int t=0; t<threads; ++t)
+        {
+            if (!partial[t].empty()) merge(total, partial[t][s], fieldMask(series[s].fieldSpec));
+        }
+
+        result_t& r = result[s];
+        r.samples   = total.samples;
+        r.min       = total.min;
+        r.max       = total.max;
+        r.changes   = total.changes;
+        r.tsFirst   = total.tsFirst;
+        r.tsLast    = total.tsLast;
+        r.histogram = total.histogram;
+        if (total.tsLast > total.tsFirst) r.rate = total.increase * 1e9 / (total.tsLast - total.tsFirst);
+    }
+
+    return result;
+}
+//=================================================================================================
@@ -0,0 +1,39 @@
+//=================================================================================================
+// TSQuery.h - Defines a multi-threaded query over a time-series file
+//=================================================================================================
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "TSStore.h"
+#include "RegStats.h"
+
+class TSQuery
+{
+public:
+
+    // One series to compute statistics for: a register column, optionally narrowed to a field
+    struct series_t
+    {
+        std::string name;
+        size_t      column;
+        uint32_t    fieldSpec;      // 0 = the whole register
+    };
+
+    // The statistics for one series over the time window
+    struct result_t
+    {
+        uint64_t         samples = 0;
+        uint32_t         min = 0, max = 0;
+        uint64_t         changes = 0;
+        double           rate = 0;          // Average increase per second, for counters
+        int64_t          tsFirst = 0, tsLast = 0;
+        LatencyHistogram histogram;         // Distribution of values, for percentiles
+    };
+
+    // Computes statistics for each series over the window [fromNs, toNs], scanning the blocks
+    // of the file with 'threads' threads.  If 'percentiles' is false, the histogram is left
+    // empty, which lets many blocks be answered from the index alone.
+    static std::vector<result_t> run(const TSReader& reader, const std::vector<series_t>& series,
+                                     int64_t fromNs, int64_t toNs, int threads, bool percentiles);
+};
@@ -0,0 +1,487 @@
+//=================================================================================================
+// TSStore.cpp - Implements a columnar on-disk format for register time series
+//=================================================================================================
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdexcept>
+#include <algorithm>
+#include "TSStore.h"
+using namespace std;
+
+// These identify the header and trailer of a time-series file
+static const char     TS_MAGIC[8]     = {'P','C','I','R','T','S','0','1'};
+static const char     TS_IDX_MAGIC[8] = {'P','C','I','R','T','S','I','X'};
+static const uint32_t TS_VERSION      = 1;
+
+// The size of the trailer: index offset, block count, magic
+static const size_t   TRAILER_SIZE    = 24;
+
+
+//=================================================================================================
+// bitsNeeded() - Returns the number of bits needed to hold 'value'
+//=================================================================================================
+static inline int bitsNeeded(uint64_t value)
+{
+    return value ? 64 - __builtin_clzll(value) : 0;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// zigzag() / unzigzag() - Map signed 32-bit differences to unsigned values so that small
+//                         differences of either sign need few bits
+//=================================================================================================
+static inline uint32_t zigzag(uint32_t current, uint32_t previous)
+{
+    int32_t d = (int32_t)(current - previous);
+    return ((uint32_t)d << 1) ^ (uint32_t)(d >> 31);
+}
+
+static inline uint32_t unzigzag(uint32_t z)
+{
+    return (z >> 1) ^ (uint32_t)-(int32_t)(z & 1);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// packedWords() - Returns how many 64-bit words it takes to hold 'count' values of 'width' bits
+//=================================================================================================
+static inline size_t packedWords(size_t count, int width)
+{
+    return (count * width + 63) / 64;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// pack() - Bit-packs 'count' values of 'width' bits each into a vector of 64-bit words
+//=================================================================================================
+static vector<uint64_t> pack(const uint64_t* value, size_t count, int width)
+{
+    vector<uint64_t> word(packedWords(count, width), 0);
+
+    // Values that are all zero take no space at all
+    if (width == 0) return word;
+
+    for (size_t i=0; i<count; ++i)
+    {
+        size_t bit   = i * width;
+        size_t index = bit >> 6;
+        int    shift = bit & 63;
+
+        word[index] |= value[i] << shift;
+        if (shift + width > 64) word[index + 1] |= value[i] >> (64 - shift);
+    }
+
+    return word;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// unpack() - Extracts the i'th value of 'width' bits from bit-packed 64-bit words
+//=================================================================================================
+static inline uint64_t unpack(const uint64_t* word, size_t i, int width)
+{
+    size_t   bit   = i * width;
+    size_t   index = bit >> 6;
+    int      shift = bit & 63;
+    uint64_t value = word[index] >> shift;
+
+    if (shift + width > 64) value |= word[index + 1] << (64 - shift);
+
+    return (width == 64) ? value : value & ((1ULL << width) - 1);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// create() - Creates the file and writes its header
+//=================================================================================================
+void TSWriter::create(string filename, const vector<column_t>& columns)
+{
+    close();
+
+    // Create the output file
+    ofile_ = fopen(filename.c_str(), "w");
+    if (ofile_ == nullptr) throw runtime_error("pcireg : cant create " + filename);
+    filename_ = filename;
+
+    // Save the column definitions and make room for a block's worth of rows
+    columns_ = columns;
+    value_.assign(columns.size(), vector<uint32_t>());
+    timestamp_.clear();
+    index_.clear();
+
+    // Build the header
+    string   header(TS_MAGIC, sizeof TS_MAGIC);
+    uint32_t field[4] = {TS_VERSION, (uint32_t)columns.size(), BLOCK_ROWS, 0};
+    header.append((char*)field, sizeof field);
+
+    // Followed by the address and name of each column
+    for (auto& column : columns)
+    {
+        uint32_t desc[2] = {column.axiAddr, (uint32_t)column.name.size()};
+        header.append((char*)desc, sizeof desc);
+        header.append(column.name);
+    }
+
+    // Blocks always start on an 8-byte boundary
+    header.resize((header.size() + 7) & ~7);
+
+    offset_ = 0;
+    write(header.data(), header.size());
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// append() - Appends a row.  'value' has one entry per column
+//=================================================================================================
+void TSWriter::append(int64_t timestamp, const uint32_t* value)
+{
+    timestamp_.push_back(timestamp);
+    for (size_t i=0; i<columns_.size(); ++i) value_[i].push_back(value[i]);
+
+    if (timestamp_.size() == BLOCK_ROWS) flushBlock();
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// flushBlock() - Encodes the buffered rows as a block, writes it, and adds it to the index
+//=================================================================================================
+void TSWriter::flushBlock()
+{
+    size_t           rows = timestamp_.size();
+    vector<uint64_t> residual(rows);
+    blockIndex_t     entry;
+
+    if (rows == 0) return;
+
+    entry.offset  = offset_;
+    entry.rows    = rows;
+    entry.tsFirst = timestamp_.front();
+    entry.tsLast  = timestamp_.back();
+
+    // Find the smallest timestamp delta in the block
+    uint64_t minDelta = UINT64_MAX;
+    for (size_t i=1; i<rows; ++i) minDelta = min(minDelta, (uint64_t)(timestamp_[i] - timestamp_[i-1]));
+    if (rows == 1) minDelta = 0;
+
+    // Each timestamp is stored as how much its delta exceeds the smallest one
+    uint64_t maxResidual = 0;
+    for (size_t i=1; i<rows; ++i)
+    {
+        residual[i-1] = (uint64_t)(timestamp_[i] - timestamp_[i-1]) - minDelta;
+        maxResidual   = max(maxResidual, residual[i-1]);
+    }
+
+    // Write the timestamp column: first timestamp, min delta, width, then the packed residuals
+    int      width     = bitsNeeded(maxResidual);
+    uint64_t header[3] = {(uint64_t)timestamp_[0], minDelta, (uint64_t)width};
+    auto     packed    = pack(residual.data(), rows - 1, width);
+    write(header, sizeof header);
+    write(packed.data(), packed.size() * sizeof(uint64_t));
+
+    // Now write each register column
+    for (auto& v : value_)
+    {
+        colIndex_t col = {v[0], v[rows-1], v[0], v[0], 0};
+        uint32_t   maxZigzag = 0;
+
+        // Encode each value as the zig-zag difference from the previous one
+        for (size_t i=1; i<rows; ++i)
+        {
+            uint32_t z = zigzag(v[i], v[i-1]);
+            residual[i-1] = z;
+            maxZigzag     = max(maxZigzag, z);
+            col.min       = min(col.min, v[i]);
+            col.max       = max(col.max, v[i]);
+            col.changes  += (z != 0);
+        }
+
+        // Write the first value, the width, then the packed differences
+        uint32_t colHeader[2] = {v[0], (uint32_t)bitsNeeded(maxZigzag)};
+        auto     packed       = pack(residual.data(), rows - 1, colHeader[1]);
+        write(colHeader, sizeof colHeader);
+        write(packed.data(), packed.size() * sizeof(uint64_t));
+
+        entry.col.push_back(col);
+        v.clear();
+    }
+
+    index_.push_back(entry);
+    timestamp_.clear();
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// close() - Writes any partial block, the index and the trailer, then closes the file
+//=================================================================================================
+void TSWriter::close()
+{
+    if (ofile_ == nullptr) return;
+
+    flushBlock();
+
+    uint64_t indexOffset = offset_;
+
+    // Write one index entry per block
+    for (auto& entry : index_)
+    {
+        uint64_t field[4] = {entry.offset, entry.rows, (uint64_t)entry.tsFirst, (uint64_t)entry.tsLast};
+        write(field, sizeof field);
+        write(entry.col.data(), entry.col.size() * sizeof(colIndex_t));
+    }
+
+    // And the trailer that tells a reader where to find the index
+    uint64_t trailer[2] = {indexOffset, index_.size()};
+    write(trailer, sizeof trailer);
+    write(TS_IDX_MAGIC, sizeof TS_IDX_MAGIC);
+
+    // Buffered data that can't be written only shows up here
+    int error = fclose(ofile_);
+    ofile_ = nullptr;
+    if (error != 0) throw runtime_error("pcireg : cant write " + filename_);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// write() - Writes to the file.  If that fails, the file is abandoned and we throw.
+//=================================================================================================
+void TSWriter::write(const void* data, size_t size)
+{
+    if (fwrite(data, 1, size, ofile_) != size)
+    {
+        fclose(ofile_);
+        ofile_ = nullptr;
+        throw runtime_error("pcireg : cant write " + filename_);
+    }
+
+    offset_ += size;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// open() - Maps a time-series file into memory and loads its header and index
+//=================================================================================================
+void TSReader::open(string filename)
+{
+    struct stat sb;
+
+    close();
+
+    // Open the file and find out how big it is
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) throw runtime_error("pcireg : cant open " + filename);
+    fstat(fd, &sb);
+
+    // Map the entire thing
+    mapSize_ = sb.st_size;
+    void* ptr = (mapSize_ > 0) ? mmap(0, mapSize_, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+    ::close(fd);
+    if (ptr == MAP_FAILED) throw runtime_error("pcireg : cant map " + filename);
+    map_ = (const uint8_t*)ptr;
+
+    // Make sure this is one of our files, and that it was closed properly
+    if (mapSize_ < sizeof TS_MAGIC + 16 + TRAILER_SIZE
+    ||  memcmp(map_, TS_MAGIC, sizeof TS_MAGIC) != 0
+    ||  memcmp(map_ + mapSize_ - sizeof TS_IDX_MAGIC, TS_IDX_MAGIC, sizeof TS_IDX_MAGIC) != 0)
+    {
+        close();
+        throw runtime_error("pcireg : " + filename + " is not a complete time-series file");
+    }
+
+    // Everything from here on comes from the file, and is checked against the mapping before
+    // it's used.  Nothing but the trailer may lie past 'limit'.
+    const uint8_t* limit = map_ + mapSize_ - TRAILER_SIZE;
+    auto corrupt = [&]()
+    {
+        close();
+        throw runtime_error("pcireg : " + filename + " is corrupt");
+    };
+
+    // Fetch the fixed part of the header
+    uint32_t field[4];
+    memcpy(field, map_ + sizeof TS_MAGIC, sizeof field);
+    if (field[0] != TS_VERSION)
+    {
+        close();
+        throw runtime_error("pcireg : unsupported version in " + filename);
+    }
+
+    // Fetch the column descriptions
+    const uint8_t* p = map_ + sizeof TS_MAGIC + sizeof field;
+    for (uint32_t i=0; i<field[1]; ++i)
+    {
+        uint32_t desc[2];
+        if (limit - p < (ptrdiff_t)sizeof desc) corrupt();
+        memcpy(desc, p, sizeof desc);
+        p += sizeof desc;
+        if ((uint64_t)(limit - p) < desc[1]) corrupt();
+        columns_.push_back({string((const char*)p, desc[1]), desc[0]});
+        p += desc[1];
+    }
+    uint64_t dataStart = p - map_;
+
+    // Fetch the trailer.  The index must fill the space between the blocks and the trailer.
+    uint64_t trailer[2];
+    memcpy(trailer, map_ + mapSize_ - TRAILER_SIZE, sizeof trailer);
+
+    uint64_t indexEnd  = limit - map_;
+    uint64_t entrySize = 4 * sizeof(uint64_t) + columns_.size() * sizeof(colIndex_t);
+    if (trailer[0] < dataStart || trailer[0] > indexEnd
+    ||  trailer[1] != (indexEnd - trailer[0]) / entrySize
+    ||  (indexEnd - trailer[0]) % entrySize != 0) corrupt();
+
+    // And load the index, making sure each block lies within the data
+    p = map_ + trailer[0];
+    for (uint64_t block=0; block<trailer[1]; ++block)
+    {
+        blockIndex_t entry;
+        uint64_t     entryField[4];
+        memcpy(entryField, p, sizeof entryField);
+        p += sizeof entryField;
+        entry.offset  = entryField[0];
+        entry.rows    = entryField[1];
+        entry.tsFirst = entryField[2];
+        entry.tsLast  = entryField[3];
+        entry.col.resize(columns_.size());
+        memcpy(entry.col.data(), p, columns_.size() * sizeof(colIndex_t));
+        p += columns_.size() * sizeof(colIndex_t);
+
+        if (entryField[1] == 0 || entryField[1] > UINT32_MAX
+        ||  entry.offset < dataStart || !blockFits(entry, trailer[0])) corrupt();
+
+        index_.push_back(entry);
+    }
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// blockFits() - Returns true if a block's columns are well-formed and end at or before 'end'
+//=================================================================================================
+bool TSReader::blockFits(const blockIndex_t& block, uint64_t end) const
+{
+    uint64_t pos  = block.offset;
+    uint64_t rows = block.rows;
+
+    // The timestamp column: first timestamp, min delta, width, packed residuals
+    if (end < pos || end - pos < 3 * sizeof(uint64_t)) return false;
+    uint64_t width;
+    memcpy(&width, map_ + pos + 2 * sizeof(uint64_t), sizeof width);
+    if (width > 64) return false;
+    pos += 3 * sizeof(uint64_t);
+    uint64_t size = packedWords(rows - 1, width) * sizeof(uint64_t);
+    if (end - pos < size) return false;
+    pos += size;
+
+    // Each register column: first value, width, packed differences
+    for (size_t col=0; col<columns_.size(); ++col)
+    {
+        uint32_t header[2];
+        if (end - pos < sizeof header) return false;
+        memcpy(header, map_ + pos, sizeof header);
+        if (header[1] > 32) return false;
+        pos += sizeof header;
+        size = packedWords(rows - 1, header[1]) * sizeof(uint64_t);
+        if (end - pos < size) return false;
+        pos += size;
+    }
+
+    return true;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// close() - Unmaps the file
+//=================================================================================================
+void TSReader::close()
+{
+    if (map_) munmap((void*)map_, mapSize_);
+    map_ = nullptr;
+    columns_.clear();
+    index_.clear();
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// decodeTimestamps() - Decodes the timestamp column of a block
+//=================================================================================================
+void TSReader::decodeTimestamps(size_t block, vector<int64_t>& out) const
+{
+    const uint64_t* p    = (const uint64_t*)(map_ + index_[block].offset);
+    size_t          rows = index_[block].rows;
+    int64_t         ts   = p[0];
+    uint64_t        minDelta = p[1];
+    int             width    = p[2];
+
+    out.resize(rows);
+    out[0] = ts;
+    for (size_t i=1; i<rows; ++i)
+    {
+        ts += minDelta + (width ? unpack(p + 3, i - 1, width) : 0);
+        out[i] = ts;
+    }
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// locateColumns() - Finds the start of each register column within a block
+//=================================================================================================
+void TSReader::locateColumns(size_t block, vector<const uint8_t*>& out) const
+{
+    const uint8_t* p    = map_ + index_[block].offset;
+    size_t         rows = index_[block].rows;
+
+    // Skip over the timestamp column
+    uint64_t width = ((const uint64_t*)p)[2];
+    p += 3 * sizeof(uint64_t) + packedWords(rows - 1, width) * sizeof(uint64_t);
+
+    // And find each register column in turn
+    out.resize(columns_.size());
+    for (size_t col=0; col<columns_.size(); ++col)
+    {
+        out[col] = p;
+        width = ((const uint32_t*)p)[1];
+        p += 2 * sizeof(uint32_t) + packedWords(rows - 1, width) * sizeof(uint64_t);
+    }
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// decodeColumn() - Decodes one register column of a block, given where locateColumns() found it
+//=================================================================================================
+void TSReader::decodeColumn(size_t block, const uint8_t* start, vector<uint32_t>& out) const
+{
+    const uint32_t* header = (const uint32_t*)start;
+    const uint64_t* packed = (const uint64_t*)(header + 2);
+    size_t          rows   = index_[block].rows;
+    uint32_t        value  = header[0];
+    int             width  = header[1];
+
+    out.assign(rows, value);
+
+    // A column that never changes within the block has no packed data at all
+    if (width == 0) return;
+
+    for (size_t i=1; i<rows; ++i)
+    {
+        value += unzigzag((uint32_t)unpack(packed, i - 1, width));
+        out[i] = value;
+    }
+}
+//=================================================================================================
@@ -0,0 +1,151 @@
+//=================================================================================================
+// TSStore.h - Defines a columnar on-disk format for register time series
+//
+// A file holds one timestamp column and one column per sampled register, split into blocks of
+// up to 'blockRows' rows.  Within a block:
+//
+//   - Timestamps are stored as deltas from the previous timestamp, minus the smallest delta
+//     in the block, bit-packed at the width of the largest remaining value.
+//
+//   - Each register column is stored as the zig-zag encoded change from the previous row,
+//     bit-packed at the width of the largest change.  A register that never changes within
+//     the block takes no space beyond its first value.
+//
+// After the blocks comes an index with one entry per block: its file offset, row count,
+// first/last timestamp, and for every column its first/last/min/max values and how many
+// times it changed.  Many queries can be answered from the index without decoding a block.
+//=================================================================================================
+#pragma once
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+class TSStore
+{
+public:
+
+    // Describes one register column
+    struct column_t
+    {
+        std::string name;
+        uint32_t    axiAddr;
+    };
+
+    // Per-column summary of a block, as stored in the index
+    struct colIndex_t
+    {
+        uint32_t first, last, min, max, changes;
+    };
+
+    // Index entry for one block
+    struct blockIndex_t
+    {
+        uint64_t                offset;
+        uint32_t                rows;
+        int64_t                 tsFirst, tsLast;
+        std::vector<colIndex_t> col;
+    };
+
+    // Number of rows in a full block
+    static const uint32_t BLOCK_ROWS = 4096;
+};
+
+
+//=================================================================================================
+// TSWriter - Writes a time-series file one row at a time
+//=================================================================================================
+class TSWriter : public TSStore
+{
+public:
+
+    // Default constructor
+    TSWriter() {};
+
+    // Destructor - finishes the file if close() wasn't called.  Errors can't be reported here.
+    ~TSWriter() {try {close();} catch (const std::exception&) {}}
+
+    // No copy or assignment constructor - objects of this class can't be copied
+    TSWriter (const TSWriter&) = delete;
+    TSWriter& operator= (const TSWriter&) = delete;
+
+    // Creates the file and writes its header
+    void    create(std::string filename, const std::vector<column_t>& columns);
+
+    // Appends a row.  'value' has one entry per column
+    void    append(int64_t timestamp, const uint32_t* value);
+
+    // Writes any partial block, the index and the trailer, then closes the file.  Throws if
+    // the file couldn't be written in full.
+    void    close();
+
+protected:
+
+    // Encodes the buffered rows as a block and writes it
+    void    flushBlock();
+
+    // Writes to the file.  On failure, abandons the file and throws.
+    void    write(const void* data, size_t size);
+
+    FILE*                               ofile_ = nullptr;
+    std::string                         filename_;
+    uint64_t                            offset_ = 0;
+    std::vector<column_t>               columns_;
+    std::vector<int64_t>                timestamp_;
+    std::vector<std::vector<uint32_t>>  value_;
+    std::vector<blockIndex_t>           index_;
+};
+//=================================================================================================
+
+
+//=================================================================================================
+// TSReader - Memory-maps a time-series file and decodes its blocks.  Once opened, a reader may
+//            be shared by any number of threads.  open() checks every length and offset in the
+//            file against its size, so a damaged file is rejected rather than read out of bounds.
+//=================================================================================================
+class TSReader : public TSStore
+{
+public:
+
+    // Default constructor
+    TSReader() {};
+
+    // Destructor
+    ~TSReader() {close();}
+
+    // No copy or assignment constructor - objects of this class can't be copied
+    TSReader (const TSReader&) = delete;
+    TSReader& operator= (const TSReader&) = delete;
+
+    // Maps the file and loads its header and index
+    void    open(std::string filename);
+
+    // Unmaps the file
+    void    close();
+
+    // Returns the list of register columns
+    const std::vector<column_t>&     columns() const {return columns_;}
+
+    // Returns the block index
+    const std::vector<blockIndex_t>& index()   const {return index_;}
+
+    // Decodes the timestamps of a block
+    void    decodeTimestamps(size_t block, std::vector<int64_t>& out) const;
+
+    // Finds the start of each register column's data within a block
+    void    locateColumns(size_t block, std::vector<const uint8_t*>& out) const;
+
+    // Decodes one register column of a block.  'start' is where locateColumns() found it.
+    void    decodeColumn(size_t block, const uint8_t* start, std::vector<uint32_t>& out) const;
+
+protected:
+
+    // Returns true if a block's columns are well-formed and end at or before file offset 'end'
+    bool    blockFits(const blockIndex_t& block, uint64_t end) const;
+
+    const uint8_t*              map_ = nullptr;
+    size_t                      mapSize_ = 0;
+    std::vector<column_t>       columns_;
+    std::vector<blockIndex_t>   index_;
+};
+//=================================================================================================
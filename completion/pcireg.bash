@@ -0,0 +1,58 @@
+#==================================================================================================
+# pcireg.bash - Bash completion for pcireg
+#
+# Source this file from ~/.bashrc, or copy it into /etc/bash_completion.d.  Register and field
+# names come from "pcireg -complete", which answers from a cached index of the symbol files, and
+# honors any -sym options already on the command line as well as $pcireg_symbols.
+#==================================================================================================
+
+_pcireg()
+{
+    local cur="${COMP_WORDS[COMP_CWORD]}"
+    local prev="${COMP_WORDS[COMP_CWORD-1]}"
+    local options="-hex -dec -fmt -wide -stats -bench -group -perf -wait -journal -journal-dump -r -d
+                   -sym -remote -qos -sim -dump -threads -mount -watch -info -serve -toggle
+                   -sample -period -count -query -from -to -nopct -subscribe -complete"
+
+    # Options that take something other than a register
+    case "$prev" in
+        -sym|-journal|-journal-dump|-sample|-query)
+            COMPREPLY=($(compgen -f -- "$cur"))
+            return;;
+        -mount)
+            COMPREPLY=($(compgen -d -- "$cur"))
+            return;;
+        -fmt)
+            COMPREPLY=($(compgen -W "text csv json bin" -- "$cur"))
+            return;;
+        -qos)
+            COMPREPLY=($(compgen -W "control interactive bulk" -- "$cur"))
+            return;;
+        -r|-d|-bench|-wait|-period|-count|-threads|-from|-to|-serve|-remote|-subscribe|-complete)
+            return;;
+    esac
+
+    if [[ "$cur" == -* ]]; then
+        COMPREPLY=($(compgen -W "$options" -- "$cur"))
+        return
+    fi
+
+    # Addresses, data values and sampling periods aren't names
+    [[ "$cur" == [0-9]* || "$cur" == *@* ]] && return
+
+    # Look in the same symbol files that the command will
+    local i sym=()
+    for ((i=1; i<COMP_CWORD-1; i++)); do
+        [[ "${COMP_WORDS[i]}" == -sym ]] && sym+=(-sym "${COMP_WORDS[i+1]/#\~/$HOME}")
+    done
+
+    local IFS=$'\n'
+    COMPREPLY=($("${COMP_WORDS[0]}" "${sym[@]}" -complete "$cur" 2>/dev/null))
+
+    # A name that stops at an underscore has more to come, so don't end the word there
+    if [[ ${#COMPREPLY[@]} -eq 1 && "${COMPREPLY[0]}" == *_ ]]; then
+        compopt -o nospace
+    fi
+}
+
+complete -F _pcireg pcireg
@@ -8,9 +8,28 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <strings.h>
 #include <stdexcept>
+#include <map>
+#include <algorithm>
+#include <thread>
+#include <signal.h>
 #include "PciDevice.h"
-#include "tokenizer.h"
+#include "RegAccess.h"
+#include "RegStats.h"
+#include "PerfCounters.h"
+#include "Journal.h"
+#include "SymbolTable.h"
+#include "Sampler.h"
+#include "TSStore.h"
+#include "TSQuery.h"
+#include "OutputWriter.h"
+#include "RegisterFS.h"
+#include "SymbolWatcher.h"
+#include "BitStats.h"
+#include "RemoteServer.h"
+#include "SampleRing.h"
+#include "SymbolIndex.h"
 
 using namespace std;
 
@@ -21,13 +40,47 @@ const int OM_HEX  = 2;
 const int OM_BOTH = 3;    
 int output_mode = OM_NONE;
 
+// The size of the region that "-sim" stands in for a device with.  It covers every address in
+// the default symbol file.
+const size_t SIM_REGION_SIZE = 0x400000;
+
 bool      wide        = false;
+bool      showStats   = false;
+bool      usePerf     = false;
+uint64_t  benchCount  = 0;
+vector<string> benchGroups;
+int       waitMs      = -1;
+string    journalFile;
+string    journalDumpFile;
+double    timeFrom    = 0;
+double    timeTo      = 0;
+string    sampleFile;
+uint64_t  samplePeriodUs = 0;
+uint64_t  sampleCount = 0;
+string    queryFile;
+string    subscribeName;
+bool      completeMode = false;
+string    completePrefix;
+int       threadCount = 0;
+bool      noPercentiles = false;
+bool      dumpMode    = false;
+string    mountPoint;
+bool      toggleMode  = false;
+bool      infoMode    = false;
+bool      watchSymbols = false;
+string    serveEndpoint;
+string    remoteEndpoint;
+bool      simulate    = false;
+uint8_t   qosClass    = RemoteProtocol::QOS_AUTO;
+OutputWriter Out;
+vector<string> args;
 int       pciRegion   = -1;
 bool      isAxiWrite  = false;
 uint32_t  axiAddr = 0xFFFFFFFF;
 uint64_t  axiData;
 string    device;
-string    symbolFile;
+vector<string> symbolFiles;
+SymbolTable    Symbols;
 int       vendorID;
 int       deviceID;
 string    symbol;
@@ -37,12 +90,25 @@ PciDevice PCI;
 
 void     showHelp();
 void     parseCommandLine(const char** argv);
-void     writeRegister(uint8_t* base_addr, uint32_t axi_addr, uint64_t data, bool wide);
-uint64_t readRegister (uint8_t* base_addr, uint32_t axi_addr,                bool wide);
-void     writeField   (uint8_t* base_addr, uint32_t axi_addr, uint64_t data, uint32_t fieldSpec);
-uint64_t readField    (uint8_t* base_addr, uint32_t axi_addr,                uint32_t fieldSpec);
 void     execute();
-uint64_t getSymbolValue(std::string symbol, std::string symbolFile);
+void     benchmark(uint8_t* baseAddr, uint32_t fieldSpec);
+void     benchmarkGroups(uint8_t* baseAddr, size_t regionSize);
+void     dumpJournal();
+void     sample(uint8_t* baseAddr, size_t regionSize);
+void     query();
+void     subscribe();
+void     complete();
+void     dump(uint8_t* baseAddr, size_t regionSize);
+void     serveFS(uint8_t* baseAddr, size_t regionSize);
+void     toggle(uint8_t* baseAddr, size_t regionSize);
+void     showInfo();
+void     serveRemote();
+void     emitValue(const string& name, uint32_t axiAddr, uint64_t value, bool wide);
+void     loadSymbols(bool required);
+string   symbolSource();
+uint64_t parsePeriod(const string& text);
+void     addChannels(vector<Sampler::channel_t>& channels, const string& arg, uint64_t periodUs,
+                     uint64_t maxPeriodUs, size_t regionSize);
 
 //=================================================================================================
 // main() - Execution starts here.  See "showHelp()" for command line 
@@ -64,6 +130,14 @@ int main(int argc, const char** argv)
     // If no device is otherwise specified, use the default
     if (device.empty()) device = "10EE:903F";
 
+    // If there was no server specified on the command line, try fetching it from the
+    // environment variable.  A server never forwards to another server.
+    if (remoteEndpoint.empty() && serveEndpoint.empty() && !simulate)
+    {
+        p = getenv("pcireg_remote");
+        if (p) remoteEndpoint = p;
+    }
+
     // If there was no region specified on the command line, try fetching it from
     // the environment variable
     if (pciRegion == -1)
@@ -75,19 +149,84 @@ int main(int argc, const char** argv)
     // If no region is otherwise specified, use the default
     if (pciRegion == -1) pciRegion = 0;
 
-    // If no symbol file was given, try fetching it from the environment variable
-    if (symbolFile.empty())
+    // If no symbol file was given, try fetching a colon-separated list of them from the
+    // environment variable
+    if (symbolFiles.empty())
     {
         p = getenv("pcireg_symbols");
-        if (p) symbolFile = p;
+        if (p)
+        {
+            string list = p;
+            for (size_t start = 0, colon = 0; colon != string::npos; start = colon + 1)
+            {
+                colon = list.find(':', start);
+                string path = list.substr(start, colon - start);
+                if (!path.empty()) symbolFiles.push_back(path);
+            }
+        }
     };
 
     // If we still don't have a symbol file, use "fpga_reg.h"
-    if (symbolFile.empty()) symbolFile = "fpga_reg.h";
+    if (symbolFiles.empty()) symbolFiles.push_back("fpga_reg.h");
+
+    // If no write journal was given, try fetching it from the environment variable
+    if (journalFile.empty())
+    {
+        p = getenv("pcireg_journal");
+        if (p) journalFile = p;
+    }
 
     try
     {
+        // If the shell wants the names that complete a word, that's all we do
+        if (completeMode)
+        {
+            complete();
+            return 0;
+        }
+
+        // If the user wants to decode a journal, that's all we do
+        if (!journalDumpFile.empty())
+        {
+            dumpJournal();
+            return 0;
+        }
+
+        // If the user wants to query a time-series file, that's all we do
+        if (!queryFile.empty())
+        {
+            query();
+            return 0;
+        }
+
+        // If the user wants to read another pcireg's sample ring, that's all we do
+        if (!subscribeName.empty())
+        {
+            subscribe();
+            return 0;
+        }
+
+        // If we're journaling writes, open the journal
+        if (!journalFile.empty())
+        {
+            WriteJournal.open(journalFile);
+            if (!mountPoint.empty())
+                WriteJournal.setSource(Journal::SRC_FUSE);
+            else if (!serveEndpoint.empty())
+                WriteJournal.setSource(Journal::SRC_REMOTE);
+            else
+                WriteJournal.setSource(benchCount ? Journal::SRC_BENCH : Journal::SRC_CLI);
+        }
+
         execute();
+
+        // If the user asked for access statistics, show them
+        if (showStats)
+        {
+            map<uint32_t, string> names = Symbols.registers();
+            if (!symbol.empty()) names[axiAddr] = symbol;
+            AccessStats.report(stderr, names);
+        }
     }
     catch(const std::exception& e)
     {
@@ -104,7 +243,21 @@ int main(int argc, const char** argv)
 void showHelp()
 {
     printf("pcireg v1.2\n");
-    printf("pcireg [-hex] [-dec] [-wide] [-r <region#>] [-d <vendor>:<device>] [-sym <filename>] <address> [data]\n");
+    printf("pcireg [-hex] [-dec] [-fmt text|csv|json|bin] [-wide] [-stats] [-bench <count>] [-perf] [-wait <ms>]\n");
+    printf("       [-journal <filename>] [-r <region#>] [-d <vendor>:<device>] [-sym <file|dir>]...\n");
+    printf("       [-remote <unix:path|host:port>] [-qos control|interactive|bulk] [-sim]\n");
+    printf("       <address> [data]\n");
+    printf("pcireg -bench <count> [-perf] [-wide] -group <name-prefix> [-group <name-prefix>]...\n");
+    printf("pcireg -journal-dump <filename> [-from <time>] [-to <time>] [-sym <file|dir>] [address]\n");
+    printf("pcireg -dump [-fmt text|csv|json|bin] [-threads <n>] [name-prefix...]\n");
+    printf("pcireg -mount <directory> [-watch] [-threads <n>]\n");
+    printf("pcireg -info\n");
+    printf("pcireg -serve <unix:path|host:port> [-d <vendor>:<device>] [-sim] [-journal <filename>]\n");
+    printf("pcireg -toggle [-fmt text|csv|json] [-period <us>] [-count <n>] <register|name-prefix> [...]\n");
+    printf("pcireg -sample <filename|-|shm:name> [-period <us>] [-count <n>] [-perf] [-watch] <register>[@<period>|@<min>..<max>] [...]\n");
+    printf("pcireg -query <filename> [-from <time>] [-to <time>] [-threads <n>] [-nopct] [series...]\n");
+    printf("pcireg -subscribe <name> [-fmt text|csv|json|bin] [-count <n>]\n");
+    printf("pcireg -complete <prefix> [-sym <file|dir>]...\n");
     exit(1);
 }
 //=================================================================================================
@@ -238,6 +391,86 @@ void parseCommandLine(const char** argv)
             continue;            
         }
 
+        // If the user wants machine-readable output...
+        if (strcmp(token, "-fmt") == 0)
+        {
+            OutputWriter::format_t format;
+            token = argv[i++];
+            if (token == nullptr || !OutputWriter::parseFormat(token, &format)) showHelp();
+            Out.setFormat(format);
+            continue;
+        }
+
+        // If the user wants to read every register in the symbol file...
+        if (strcmp(token, "-dump") == 0)
+        {
+            dumpMode = true;
+            continue;
+        }
+
+        // If the user wants long-running modes to pick up changes to the symbol files...
+        if (strcmp(token, "-watch") == 0)
+        {
+            watchSymbols = true;
+            continue;
+        }
+
+        // If the user wants to know about the device and its PCIe link...
+        if (strcmp(token, "-info") == 0)
+        {
+            infoMode = true;
+            continue;
+        }
+
+        // If the user wants per-bit toggle counts for a set of registers...
+        if (strcmp(token, "-toggle") == 0)
+        {
+            toggleMode = true;
+            continue;
+        }
+
+        // If the user wants the registers mounted as a filesystem...
+        if (strcmp(token, "-mount") == 0)
+        {
+            token = argv[i++];
+            if (token == nullptr) showHelp();
+            mountPoint = token;
+            continue;
+        }
+
+        // If the user wants to serve the device to remote clients...
+        if (strcmp(token, "-serve") == 0)
+        {
+            token = argv[i++];
+            if (token == nullptr) showHelp();
+            serveEndpoint = token;
+            continue;
+        }
+
+        // If the device is on another host, served by "pcireg -serve"...
+        if (strcmp(token, "-remote") == 0)
+        {
+            token = argv[i++];
+            if (token == nullptr) showHelp();
+            remoteEndpoint = token;
+            continue;
+        }
+
+        // The QoS class of our requests to a server
+        if (strcmp(token, "-qos") == 0)
+        {
+            token = argv[i++];
+            if (token == nullptr || !RemoteProtocol::parseQos(token, &qosClass)) showHelp();
+            continue;
+        }
+
+        // If the user wants a simulated device instead of real hardware...
+        if (strcmp(token, "-sim") == 0)
+        {
+            simulate = true;
+            continue;
+        }
+
         // If the user wants to perform a 64-bit read/write...
         if (strcmp(token, "-wide") == 0)
         {
@@ -245,15 +478,161 @@ void parseCommandLine(const char** argv)
             continue;
         }
 
-        // If the user is giving us the name of a symbol file
+        // If the user wants per-register access counts and latencies...
+        if (strcmp(token, "-stats") == 0)
+        {
+            showStats = true;
+            AccessStats.enable(true);
+            continue;
+        }
+
+        // If the user wants to time a loop of accesses to the register...
+        if (strcmp(token, "-bench") == 0)
+        {
+            token = argv[i++];
+            if (token == nullptr) showHelp();
+            benchCount = strToBin64(token);
+            continue;
+        }
+
+        // A group of registers to benchmark, selected by name prefix.  This can be given more
+        // than once, and each group is timed and counted separately.
+        if (strcmp(token, "-group") == 0)
+        {
+            token = argv[i++];
+            if (token == nullptr) showHelp();
+            benchGroups.push_back(token);
+            continue;
+        }
+
+        // If the user wants CPU performance counters wrapped around the benchmark loop...
+        if (strcmp(token, "-perf") == 0)
+        {
+            usePerf = true;
+            continue;
+        }
+
+        // If the user wants to wait for the register to hold the value given as data...
+        if (strcmp(token, "-wait") == 0)
+        {
+            token = argv[i++];
+            if (token == nullptr) showHelp();
+            waitMs = strToBin32(token);
+            continue;
+        }
+
+        // If the user wants every write recorded in a journal...
+        if (strcmp(token, "-journal") == 0)
+        {
+            token = argv[i++];
+            if (token == nullptr) showHelp();
+            journalFile = token;
+            continue;
+        }
+
+        // If the user wants to decode a journal...
+        if (strcmp(token, "-journal-dump") == 0)
+        {
+            token = argv[i++];
+            if (token == nullptr) showHelp();
+            journalDumpFile = token;
+            continue;
+        }
+
+        // If the user wants to sample registers into a time-series file...
+        if (strcmp(token, "-sample") == 0)
+        {
+            token = argv[i++];
+            if (token == nullptr) showHelp();
+            sampleFile = token;
+            continue;
+        }
+
+        // The sampling period, in microseconds
+        if (strcmp(token, "-period") == 0)
+        {
+            token = argv[i++];
+            if (token == nullptr) showHelp();
+            samplePeriodUs = strToBin64(token);
+            continue;
+        }
+
+        // The number of samples to take
+        if (strcmp(token, "-count") == 0)
+        {
+            token = argv[i++];
+            if (token == nullptr) showHelp();
+            sampleCount = strToBin64(token);
+            continue;
+        }
+
+        // If the shell wants the register and field names that start with a prefix...
+        if (strcmp(token, "-complete") == 0 || strcmp(token, "--complete") == 0)
+        {
+            token = argv[i++];
+            if (token == nullptr) showHelp();
+            completeMode   = true;
+            completePrefix = token;
+            continue;
+        }
+
+        // If the user wants to read the sample ring that another pcireg is publishing...
+        if (strcmp(token, "-subscribe") == 0)
+        {
+            token = argv[i++];
+            if (token == nullptr) showHelp();
+            subscribeName = token;
+            continue;
+        }
+
+        // If the user wants to query a time-series file...
+        if (strcmp(token, "-query") == 0)
+        {
+            token = argv[i++];
+            if (token == nullptr) showHelp();
+            queryFile = token;
+            continue;
+        }
+
+        // The number of threads to use for operations that can use several
+        if (strcmp(token, "-threads") == 0)
+        {
+            token = argv[i++];
+            if (token == nullptr) showHelp();
+            threadCount = strToBin32(token);
+            continue;
+        }
+
+        // If the user doesn't need percentiles from a query...
+        if (strcmp(token, "-nopct") == 0)
+        {
+            noPercentiles = true;
+            continue;
+        }
+
+        // Times (in seconds since the Unix epoch) that limit which records are examined
+        if (strcmp(token, "-from") == 0 || strcmp(token, "-to") == 0)
+        {
+            double& limit = (token[1] == 'f') ? timeFrom : timeTo;
+            token = argv[i++];
+            if (token == nullptr) showHelp();
+            limit = strtod(token, 0);
+            continue;
+        }
+
+        // If the user is giving us the name of a symbol file (or a directory of them).  This
+        // can be given more than once.
         if (strcmp(token, "-sym") == 0)
         {
             token = argv[i++];
             if (token == nullptr) showHelp();
-            symbolFile = token;
+            symbolFiles.push_back(token);
             continue;
         }
 
+        // Keep a list of every positional parameter for the modes that take several
+        args.push_back(token);
+
         // Store this parameter into either "address", "symbol" or "data"
         if (++index == 1)
         {
@@ -269,8 +648,67 @@ void parseCommandLine(const char** argv)
         }
     }
 
+    // When decoding a journal or querying a time-series, the addresses are optional filters
+    if (!journalDumpFile.empty() || !queryFile.empty()) return;
+
+    // A completion query takes no positional parameters
+    if (completeMode)
+    {
+        if (!args.empty()) showHelp();
+        return;
+    }
+
+    // A subscriber takes no positional parameters
+    if (!subscribeName.empty())
+    {
+        if (!args.empty()) showHelp();
+        return;
+    }
+
+    // When sampling, every positional parameter is a register to sample
+    if (!sampleFile.empty() || toggleMode)
+    {
+        if (args.empty()) showHelp();
+        isAxiWrite = false;
+        return;
+    }
+
+    // Device information needs no address
+    if (infoMode) return;
+
+    // When dumping, every positional parameter is a register-name prefix
+    if (dumpMode)
+    {
+        isAxiWrite = false;
+        return;
+    }
+
+    // A server takes no positional parameters
+    if (!serveEndpoint.empty())
+    {
+        if (!args.empty()) showHelp();
+        return;
+    }
+
+    // A mounted filesystem takes no positional parameters
+    if (!mountPoint.empty())
+    {
+        if (!args.empty()) showHelp();
+        return;
+    }
+
+    // A group benchmark reads the groups it was given, and takes no positional parameters
+    if (benchCount && !benchGroups.empty())
+    {
+        if (!args.empty()) showHelp();
+        return;
+    }
+
     // If the user failed to give us an address, that's fatal
     if ((axiAddr == 0xFFFFFFFF) & symbol.empty()) showHelp();
+
+    // A wait needs a value to wait for
+    if (waitMs >= 0 && !isAxiWrite) showHelp();
 }
 //=================================================================================================
 
@@ -283,26 +721,91 @@ void execute()
     uint64_t symbolValue;
     uint32_t fieldSpec = 0;
 
-    // Map the PCI memory-mapped resource regions into user-space
-    PCI.open(device);
+    // Map the PCI memory-mapped resource regions into user-space, or connect to the server that
+    // has them mapped, or stand in for them with ordinary memory
+    if (!remoteEndpoint.empty())
+        PCI.openRemote(remoteEndpoint);
+    else if (simulate)
+        PCI.openSimulated(SIM_REGION_SIZE);
+    else
+        PCI.open(device);
 
     // Fetch the list of memory mapped resource regions
     auto resource = PCI.resourceList();
 
+    // If the user just wants to know about the device, tell them
+    if (infoMode)
+    {
+        showInfo();
+        return;
+    }
+
+    // If the user wants to serve the device to remote clients, do that.  Clients choose regions.
+    if (!serveEndpoint.empty())
+    {
+        serveRemote();
+        return;
+    }
+
     // If the user told us to use a non-existent PCI resource region, that's fatal
     if (pciRegion < 0 || pciRegion >= resource.size())
     {
         throw runtime_error("illegal PCI region");
     }
 
-    // Fetch the userspace address of the PCIe resource
+    // Fetch the userspace address of the PCIe resource.  A remote device has none; the server
+    // is told which region we mean instead.
     uint8_t* baseAddr = (resource[pciRegion].baseAddr);
+    if (PCI.isRemote())
+    {
+        Remote->selectRegion(pciRegion);
+        Remote->setQos(qosClass);
+    }
+
+    // If the user wants to sample a set of registers, go do that
+    if (!sampleFile.empty())
+    {
+        sample(baseAddr, resource[pciRegion].size);
+        return;
+    }
+
+    // If the user wants to dump every register, go do that
+    if (dumpMode)
+    {
+        dump(baseAddr, resource[pciRegion].size);
+        return;
+    }
+
+    // If the user wants per-bit toggle counts, go do that
+    if (toggleMode)
+    {
+        toggle(baseAddr, resource[pciRegion].size);
+        return;
+    }
+
+    // If the user wants the registers mounted as a filesystem, go do that
+    if (!mountPoint.empty())
+    {
+        serveFS(baseAddr, resource[pciRegion].size);
+        return;
+    }
+
+    // If the user wants to benchmark groups of registers, go do that
+    if (benchCount && !benchGroups.empty())
+    {
+        benchmarkGroups(baseAddr, resource[pciRegion].size);
+        return;
+    }
 
     // If the user specified the address as a symbol...
     if (!symbol.empty())
     {
         // Look up the value of the symbol
-        symbolValue = getSymbolValue(symbol, symbolFile);
+        loadSymbols(true);
+        if (!Symbols.find(symbol, &symbolValue))
+        {
+            throw runtime_error("pcireg : cant find "+symbol+" in "+symbolSource());
+        }
         
         // The address of the register is the lower 32 bits of the symbol value
         axiAddr = (uint32_t)(symbolValue & 0xFFFFFFFF);
@@ -320,8 +823,28 @@ void execute()
         throw runtime_error("illegal AXI address");
     }
 
+    // If the user wants a benchmark, go run it
+    if (benchCount)
+    {
+        benchmark(baseAddr, fieldSpec);
+        return;
+    }
+
+    // If we're waiting for the register to hold a value, do so.  Then fall through to
+    // display the last value we read
+    if (waitMs >= 0)
+    {
+        if (fieldSpec) wide = false;
+        if (!waitRegister(baseAddr, axiAddr, fieldSpec, wide, axiData, waitMs, &axiData))
+        {
+            char err[100];
+            sprintf(err, "pcireg : timed out, last value was 0x%lX", axiData);
+            throw runtime_error(err);
+        }
+    }
+
     // If we're writing a value (i.e., not reading one) make it so
-    if (isAxiWrite)
+    else if (isAxiWrite)
     {
         if (fieldSpec == 0)
             writeRegister(baseAddr, axiAddr, axiData, wide);
@@ -330,9 +853,9 @@ void execute()
         return;
     }
 
-    // If we get here, we're reading a register or a field within a register.
+    // Otherwise, we're reading a register or a field within a register.
     // Field reads are never wide, they are always within a single 32-bit register
-    if (fieldSpec == 0)
+    else if (fieldSpec == 0)
         axiData = readRegister(baseAddr, axiAddr, wide);
     else 
     {
@@ -342,27 +865,7 @@ void execute()
 
         
     // Display the data we read
-    if (wide) switch (output_mode)
-    {
-        case OM_DEC:   printf("%lu\n", axiData);
-                       break;
-        case OM_HEX:   printf("%016lX\n", axiData);
-                       break;
-        case OM_BOTH:  printf("%lu %016lX\n", axiData, axiData);
-                       break;
-        default:       printf("0x%016lX (%lu)\n", axiData, axiData);        
-    }
-    else switch (output_mode)
-    {
-        case OM_DEC:   printf("%lu\n", axiData);
-                       break;
-        case OM_HEX:   printf("%08lX\n", axiData);
-                       break;
-        case OM_BOTH:  printf("%lu %08lX\n", axiData, axiData);
-                       break;
-        default:       printf("0x%08lX (%lu)\n", axiData, axiData);        
-    }
-
+    emitValue(symbol, axiAddr, axiData, wide);
 }
 //=================================================================================================
 
@@ -370,181 +873,1090 @@ void execute()
 
 
 //=================================================================================================
-// writeRegister- Writes either :
-//                  A single 32-bit value in a register
-//                         -- or --
-//                  A pair of 32-bit values into adjacent registers
+// benchmark() - Performs 'benchCount' back-to-back accesses to the register (or field) that
+//               was specified on the command line, and reports how long they took.  If 'usePerf'
+//               is set, the loop is wrapped in a group of CPU performance counters so we can see
+//               what the accesses cost the host CPU.
 //=================================================================================================
-void writeRegister(uint8_t* base_addr, uint32_t axi_addr, uint64_t data, bool wide)
+void benchmark(uint8_t* baseAddr, uint32_t fieldSpec)
 {
-    // Get the userspace address of this register
-    uint32_t* addr = (uint32_t*)(base_addr + axi_addr);
+    PerfCounters perf;
+    volatile uint64_t sink;
 
-    // If we're supposed to write the upper 32-bits to a register make it so
-    if (wide) *addr++ = (uint32_t)(data >> 32);
+    // If the user wants performance counters, open them
+    if (usePerf && !perf.open())
+    {
+        fprintf(stderr, "pcireg : performance counters are unavailable on this host\n");
+    }
 
-    // And write the lower 32-bits of the value into the register
-    *addr = (uint32_t)(data & 0xFFFFFFFF);
-}
-//=================================================================================================
+    // Field accesses are never wide
+    if (fieldSpec) wide = false;
 
+    // Start the counters and the clock
+    perf.start();
+    uint64_t startTime = RegStats::now();
 
-//=================================================================================================
-// readRegister - Reads either :
-//                   A single 32-bit value in a register
-//                          -- or --
-//                   A pair of 32-bit values into adjacent registers
-//=================================================================================================
-uint64_t readRegister(uint8_t* base_addr, uint32_t axi_addr, bool wide)
+    // Perform the accesses
+    for (uint64_t n=0; n<benchCount; ++n)
+    {
+        if (isAxiWrite)
+        {
+            if (fieldSpec == 0)
+                writeRegister(baseAddr, axiAddr, axiData, wide);
+            else
+                writeField(baseAddr, axiAddr, axiData, fieldSpec);
+        }
+        else
+        {
+            if (fieldSpec == 0)
+                sink = readRegister(baseAddr, axiAddr, wide);
+            else
+                sink = readField(baseAddr, axiAddr, fieldSpec);
+        }
+    }
+
+    // Stop the clock and the counters
+    uint64_t elapsed = RegStats::now() - startTime;
+    auto counts = perf.stop();
+    (void)sink;
+
+    // Report the results.  Costs are per 32-bit access, so wide and narrow runs compare directly.
+    uint64_t accesses = benchCount * (wide ? 2 : 1);
+    printf("%lu %s%s of 0x%08X in %.3f ms, %.1f ns/access, %.2f MB/s\n", benchCount,
+           wide ? "64-bit " : "", isAxiWrite ? "writes" : "reads", axiAddr, elapsed / 1e6,
+           (double)elapsed / accesses, elapsed ? 4e3 * accesses / elapsed : 0.0);
+
+    if (usePerf) PerfCounters::print(stdout, "perf:", counts, accesses);
+
+    // The link often explains why one host is faster than another
+    PciDevice::printLinkInfo(stdout, "link: ", PCI.linkInfo());
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// benchmarkGroups() - Reads each group of registers selected with "-group <prefix>" 'benchCount'
+//                     times over, and reports the time (and, with -perf, the CPU counters) that
+//                     each group cost, per 32-bit access
+//=================================================================================================
+void benchmarkGroups(uint8_t* baseAddr, size_t regionSize)
 {
-    // Get the userspace address of this register
-    uint32_t* addr = (uint32_t*)(base_addr + axi_addr);
+    PerfCounters perf;
+    volatile uint64_t sink;
+
+    loadSymbols(true);
 
-    // If we're returning a 64-bit value, read both registers
-    if (wide)
+    // If the user wants performance counters, open them
+    if (usePerf && !perf.open())
     {
-        uint64_t hi = addr[0];
-        uint64_t lo = addr[1];
-        return (hi << 32) | lo;        
+        fprintf(stderr, "pcireg : performance counters are unavailable on this host\n");
     }
-    
-    // Otherwise, just return whatever is stored at the single 32-bit register
-    return addr[0];
+
+    for (auto& group : benchGroups)
+    {
+        vector<Sampler::channel_t> channels;
+        addChannels(channels, group, 0, 0, regionSize);
+
+        // Start the counters and the clock
+        perf.start();
+        uint64_t startTime = RegStats::now();
+
+        for (uint64_t n=0; n<benchCount; ++n)
+        {
+            for (auto& channel : channels) sink = readRegister(baseAddr, channel.axiAddr, wide);
+        }
+
+        // Stop the clock and the counters
+        uint64_t elapsed = RegStats::now() - startTime;
+        auto counts = perf.stop();
+
+        uint64_t accesses = benchCount * channels.size() * (wide ? 2 : 1);
+        printf("%s: %lu registers, %lu %sreads in %.3f ms, %.1f ns/access, %.2f MB/s\n",
+               group.c_str(), channels.size(), benchCount * channels.size(), wide ? "64-bit " : "",
+               elapsed / 1e6, (double)elapsed / accesses, elapsed ? 4e3 * accesses / elapsed : 0.0);
+
+        if (usePerf) PerfCounters::print(stdout, ("perf(" + group + "):").c_str(), counts, accesses);
+    }
+    (void)sink;
+
+    // The link often explains why one host is faster than another
+    PciDevice::printLinkInfo(stdout, "link: ", PCI.linkInfo());
 }
 //=================================================================================================
 
 
+//=================================================================================================
+// showInfo() - Displays the device's location, its memory-mapped regions, and its PCIe link
+//=================================================================================================
+void showInfo()
+{
+    auto& resource = PCI.resourceList();
+
+    if (PCI.isRemote())
+        printf("server           : %s\n", remoteEndpoint.c_str());
+    else if (simulate)
+        printf("device           : simulated\n");
+    else
+    {
+        printf("device           : %s\n", device.c_str());
+        printf("sysfs            : %s\n", PCI.deviceDir().c_str());
+    }
 
+    for (size_t i=0; i<resource.size(); ++i)
+    {
+        printf("region %-9lu : 0x%012lX, %lu bytes\n", i, (unsigned long)resource[i].physAddr,
+               resource[i].size);
+    }
+
+    PciDevice::printLinkInfo(stdout, "", PCI.linkInfo());
+}
 //=================================================================================================
-// writeField - Writes a specific bit-field within a register
+
+
+//=================================================================================================
+// dumpJournal() - Decodes the records in a write journal and prints them, oldest first
+//
+// If an address or symbol was given on the command line, only writes to that register are
+// shown.  If -from or -to were given, only writes within that time window are shown.
 //=================================================================================================
-void writeField(uint8_t* base_addr, uint32_t axi_addr, uint64_t data, uint32_t fieldSpec)
-{   
-    // Get the userspace address of this register
-    uint32_t* addr = (uint32_t*)(base_addr + axi_addr);
+void dumpJournal()
+{
+    Journal     journal;
+    uint64_t    symbolValue;
 
-    // Find the current value of the register
-    uint32_t currentValue = *addr;
+    journal.open(journalDumpFile);
 
-    // Fetch the bit-field's width, and the position of the right-most bit
-    uint32_t width = (fieldSpec >> 24) & 0xFF;
-    uint32_t pos   = (fieldSpec >> 16) & 0xFF;
+    // Register names are a convenience.  If we can't load them, we'll print addresses alone
+    loadSymbols(false);
 
-    // This is all 1's in the right-most 'width' bits
-    uint32_t mask = (1 << width) - 1;
+    // If the user wants to filter by a symbolic register name, look up its address
+    if (!symbol.empty())
+    {
+        if (!Symbols.find(symbol, &symbolValue))
+        {
+            throw runtime_error("pcireg : cant find "+symbol+" in "+symbolSource());
+        }
+        axiAddr = (uint32_t)(symbolValue & 0xFFFFFFFF);
+    }
 
-    // Mask off any invalid bits of the data we're going to write
-    uint32_t maskedData = (uint32_t)(data & mask);
+    // Convert the time limits to nanoseconds
+    int64_t fromNs = (int64_t)(timeFrom * 1e9);
+    int64_t toNs   = (timeTo == 0) ? INT64_MAX : (int64_t)(timeTo * 1e9);
 
-    // In the newValue, set all bits of this field to zero
-    uint32_t newValue = currentValue & ~(mask << pos);
+    for (auto& r : journal.readAll())
+    {
+        // Skip records the user didn't ask for
+        if (axiAddr != 0xFFFFFFFF && r.offset != axiAddr) continue;
+        int64_t ns = r.timeNs;
+        if (ns < fromNs || ns > toNs) continue;
+
+        // Format the timestamp
+        char   timestamp[40];
+        time_t secs = ns / 1000000000;
+        strftime(timestamp, sizeof timestamp, "%Y-%m-%d %H:%M:%S", localtime(&secs));
+
+        // Format the old value, if we know it
+        char oldValue[20] = "?";
+        if (r.flags & Journal::OLD_VALID) sprintf(oldValue, "0x%08X", r.oldValue);
+
+        printf("%s.%09ld %7u %-6s 0x%08X %-10s -> 0x%08X  %s\n",
+               timestamp, (long)(ns % 1000000000), r.pid, Journal::sourceName(r.source),
+               r.offset, oldValue, r.newValue, Symbols.nameOf(r.offset).c_str());
+    }
+}
+//=================================================================================================
 
-    // Stamp the data value into the bit-field
-    newValue |= (maskedData << pos);
 
-    // And store the new value into the register
-    *addr = newValue;
+//=================================================================================================
+// epochNs() - Returns the current wall-clock time in nanoseconds since the Unix epoch
+//=================================================================================================
+int64_t epochNs()
+{
+    timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
 }
 //=================================================================================================
 
 
+//=================================================================================================
+// putValueText() - Appends a register value to the output in the human-readable layout that
+//                  the user selected with -hex and/or -dec, followed by a newline
+//=================================================================================================
+void putValueText(uint64_t value, bool wide)
+{
+    int digits = wide ? 16 : 8;
+
+    switch (output_mode)
+    {
+        case OM_DEC:   Out.putDec(value);
+                       break;
+        case OM_HEX:   Out.putHex(value, digits);
+                       break;
+        case OM_BOTH:  Out.putDec(value);
+                       Out.put(' ');
+                       Out.putHex(value, digits);
+                       break;
+        default:       Out.put("0x");
+                       Out.putHex(value, digits);
+                       Out.put(" (");
+                       Out.putDec(value);
+                       Out.put(')');
+    }
+
+    Out.put('\n');
+}
+//=================================================================================================
 
 
+//=================================================================================================
+// emitValue() - Outputs a single register value in whatever format the user selected
+//=================================================================================================
+void emitValue(const string& name, uint32_t axiAddr, uint64_t value, bool wide)
+{
+    if (Out.format() == OutputWriter::FMT_TEXT)
+        putValueText(value, wide);
+    else
+        Out.record(epochNs(), name, axiAddr, value, wide);
+}
+//=================================================================================================
+
 
 //=================================================================================================
-// readField - Reads a specific bit-field within a register
+// dump() - Reads every register in the symbol file, in address order, and outputs its value.
+//          If there are positional parameters, only registers whose names start with one of
+//          them are read.
 //=================================================================================================
-uint64_t readField(uint8_t* base_addr, uint32_t axi_addr, uint32_t fieldSpec)
-{   
-    // Get the userspace address of this register
-    uint32_t* addr = (uint32_t*)(base_addr + axi_addr);
+void dump(uint8_t* baseAddr, size_t regionSize)
+{
+    vector<uint32_t> addrs;
+    vector<string>   names;
+    vector<bool>     parallel;
 
-    // Find the current value of the register
-    uint32_t currentValue = *addr;
+    loadSymbols(true);
 
-    // Fetch the bit-field's width, and the position of the right-most bit
-    uint32_t width = (fieldSpec >> 24) & 0xFF;
-    uint32_t pos   = (fieldSpec >> 16) & 0xFF;
+    for (auto& reg : Symbols.registers())
+    {
+        uint32_t      addr = reg.first;
+        const string& name = reg.second;
+
+        // Skip registers that are outside of the region or that the user didn't ask for
+        if (addr >= regionSize) continue;
+        bool wanted = args.empty();
+        for (auto& prefix : args) wanted |= (name.compare(0, prefix.size(), prefix) == 0);
+        if (!wanted) continue;
+
+        // Only registers with no read side-effects may be read out of order
+        addrs.push_back(addr);
+        names.push_back(name);
+        parallel.push_back(Symbols.isReadSafe(addr));
+    }
 
-    // This is all 1's in the right-most 'width' bits
-    uint32_t mask = (1 << width) - 1;
+    // Read every register first, so the values are as close together in time as possible
+    vector<uint32_t> value(addrs.size());
+    int64_t          timestamp = epochNs();
+    uint64_t         startTime = RegStats::now();
+    readRegisters(baseAddr, addrs, parallel, threadCount, value.data());
+    uint64_t         elapsed   = RegStats::now() - startTime;
 
-    // Hand the caller the value of this bit-field
-    return (currentValue >> pos) & mask;
+    for (size_t i=0; i<addrs.size(); ++i)
+    {
+        // Machine-readable formats get a record
+        if (Out.format() != OutputWriter::FMT_TEXT)
+        {
+            Out.record(timestamp, names[i], addrs[i], value[i]);
+            continue;
+        }
+
+        // Text gets the name, the address, and the value
+        Out.put(names[i]);
+        for (size_t n = names[i].size(); n < 40; ++n) Out.put(' ');
+        Out.put(" 0x");
+        Out.putHex(addrs[i], 8);
+        Out.put("  ");
+        putValueText(value[i], false);
+    }
+
+    // If the user wants statistics, tell them how long the snapshot took
+    if (showStats)
+    {
+        size_t fanOut = (threadCount > 1) ? count(parallel.begin(), parallel.end(), true) : 0;
+        fprintf(stderr, "pcireg : read %lu registers in %.1f us (%lu on %i threads, %lu serially)\n",
+                addrs.size(), elapsed / 1e3, fanOut, max(threadCount, 1), addrs.size() - fanOut);
+    }
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// serveFS() - Mounts the registers as a filesystem and serves it until it's unmounted or the
+//             user hits Ctrl-C
+//=================================================================================================
+void serveFS(uint8_t* baseAddr, size_t regionSize)
+{
+    struct sigaction sa;
+
+    loadSymbols(true);
+
+    RegisterFS    fs(baseAddr, regionSize, threadCount);
+    SymbolWatcher watcher;
+    fs.build(Symbols);
+
+    // If the user wants it, the tree follows changes to the symbol files
+    if (watchSymbols)
+    {
+        watcher.start(symbolFiles, threadCount, Symbols);
+        fs.watch(&watcher);
+    }
+
+    // The handler is installed without SA_RESTART so that it interrupts the read of /dev/fuse
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = [](int) {RegisterFS::stop();};
+    sigaction(SIGINT,  &sa, nullptr);
+    sigaction(SIGTERM, &sa, nullptr);
+
+    fs.mount(mountPoint);
+    fprintf(stderr, "pcireg : %lu registers mounted on %s\n", Symbols.registers().size(),
+            mountPoint.c_str());
+
+    fs.run();
+    fs.unmount();
+
+    fprintf(stderr, "pcireg : served %lu requests\n", fs.requests());
 }
 //=================================================================================================
 
 
+//=================================================================================================
+// serveRemote() - Serves the device to remote pcireg clients until the user hits Ctrl-C, then
+//                 reports how long each class of request was kept waiting
+//=================================================================================================
+void serveRemote()
+{
+    struct sigaction sa;
+
+    RemoteServer server(PCI.resourceList());
+
+    // The handler is installed without SA_RESTART so that it interrupts the wait for clients
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = [](int) {RemoteServer::stop();};
+    sigaction(SIGINT,  &sa, nullptr);
+    sigaction(SIGTERM, &sa, nullptr);
+
+    fprintf(stderr, "pcireg : serving %lu regions on %s\n", PCI.resourceList().size(),
+            serveEndpoint.c_str());
 
+    server.serve(serveEndpoint);
 
-//=============================================================================
-// getSymbolValue() - Returns the 64-bit value that corresponds to the
-//                    specified symbol
-//=============================================================================
-uint64_t getSymbolValue(string symbol, string symbolFile)
+    fprintf(stderr, "pcireg : served %lu requests\n", server.requests());
+    server.report(stderr);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// resolveSymbol() - Returns the value of a token that is either a number or a symbol name
+//=================================================================================================
+uint64_t resolveSymbol(const string& token)
 {
-    char line[10000];
-    CTokenizer tokenizer;
-    string     err;
+    uint64_t value;
 
-    // Open the input file
-    FILE* ifile = fopen(symbolFile.c_str(), "r");
+    // If the token is numeric, it's an address
+    if (token[0] >= '0' && token[0] <= '9') return strToBin64(token.c_str());
 
-    // If we can't open the input file, complain
-    if (ifile == nullptr)
+    // Otherwise, look it up
+    if (!Symbols.find(token, &value))
     {
-        err = "pcireg : cant open symbol file" + symbolFile;
-        throw runtime_error(err);
+        throw runtime_error("pcireg : cant find "+token+" in "+symbolSource());
     }
 
-    // Loop through the symbol file...
-    while (fgets(line, sizeof(line), ifile))
+    return value;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// parsePeriod() - Converts a sampling period such as "250", "10ms", "1s" or "100hz" into
+//                 microseconds.  A bare number is in microseconds.
+//=================================================================================================
+uint64_t parsePeriod(const string& text)
+{
+    char*  unit;
+    double number = strtod(text.c_str(), &unit);
+    double us     = -1;
+
+    if      (strcmp(unit, "")   == 0 || strcmp(unit, "us") == 0) us = number;
+    else if (strcmp(unit, "ms") == 0) us = number * 1e3;
+    else if (strcmp(unit, "s")  == 0) us = number * 1e6;
+    else if (strcasecmp(unit, "hz") == 0 && number > 0) us = 1e6 / number;
+
+    if (us < 1) throw runtime_error("pcireg : bad sampling period "+text);
+    return (uint64_t)(us + 0.5);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// addChannels() - Adds the registers that a command-line parameter selects to a list of channels
+//
+// The parameter is an address, the name of a register or field (a field is sampled as its
+// entire register), or a prefix that selects every register whose name starts with it.
+//
+// 'maxPeriodUs' is 0 for a fixed period, or the longest period of an adaptive channel.  A
+// register that's already in the list isn't added again; instead its range of periods is
+// narrowed to the faster of the two at each end.  A period of 0 means "as fast as possible",
+// which is fastest.
+//=================================================================================================
+void addChannels(vector<Sampler::channel_t>& channels, const string& arg, uint64_t periodUs,
+                 uint64_t maxPeriodUs, size_t regionSize)
+{
+    auto faster = [](uint64_t a, uint64_t b) {return (a == 0 || b == 0) ? 0 : std::min(a, b);};
+
+    vector<uint32_t> addrs;
+    uint64_t         value;
+
+    // An address, or the name of a register or field, is one register
+    if ((arg[0] >= '0' && arg[0] <= '9') || Symbols.find(arg, &value))
+        addrs.push_back((uint32_t)(resolveSymbol(arg) & 0xFFFFFFFF));
+
+    // Otherwise, it's a prefix of register names
+    else for (auto& reg : Symbols.registers())
     {
-        // Point to the first character of the line
-        char* in = line;
+        if (reg.second.compare(0, arg.size(), arg) == 0) addrs.push_back(reg.first);
+    }
 
-        // Skip over spaces and tabs
-        while (*in == 32 || *in == 9) ++in;
+    if (addrs.empty()) throw runtime_error("pcireg : cant find "+arg+" in "+symbolSource());
 
-        // If it's the end of the line, ignore the line
-        if (*in == 10 || *in == 13 || *in == 0) continue;
+    for (auto addr : addrs)
+    {
+        if (addr >= regionSize) throw runtime_error("illegal AXI address");
+
+        // Don't sample a register twice
+        auto it = find_if(channels.begin(), channels.end(),
+                          [&](const Sampler::channel_t& c) {return c.axiAddr == addr;});
+        if (it != channels.end())
+        {
+            uint64_t lo = faster(it->periodUs, periodUs);
+            uint64_t hi = faster(max(it->maxPeriodUs, it->periodUs), max(maxPeriodUs, periodUs));
+            it->periodUs    = lo;
+            it->maxPeriodUs = (hi > lo) ? hi : 0;
+            continue;
+        }
 
-        // If it's a comment, ignore the line
-        if (in[0] == '/' && in[1] == '/') continue;
+        // Each channel is named for its register, if we know the name
+        string name = Symbols.nameOf(addr);
+        if (name.empty())
+        {
+            char hex[20];
+            sprintf(hex, "0x%08X", addr);
+            name = hex;
+        }
 
-        // Parse this line into tokens
-        vector<string> token = tokenizer.parse(in);
+        channels.push_back({name, addr, periodUs, maxPeriodUs});
+    }
+}
+//=================================================================================================
 
-        // If there aren't exactly 3 tokens on the line, ignore the line
-        if (token.size() != 3) continue;
 
-        // If the first token isn't "#define", ignore the line
-        if (token[0] != "#define") continue;
+//=================================================================================================
+// sample() - Samples the registers named on the command line into a time-series file, to
+//            stdout if the filename is "-", or into a shared-memory ring that other processes
+//            can subscribe to if it's "shm:<name>".  Sampling stops after 'sampleCount' sweeps,
+//            or when the user hits Ctrl-C.
+//=================================================================================================
+void sample(uint8_t* baseAddr, size_t regionSize)
+{
+    vector<Sampler::channel_t> channels;
+    TSWriter                   writer;
+    SampleRing                 ring;
+    bool                       toStdout = (sampleFile == "-");
+    bool                       toRing   = (sampleFile.compare(0, 4, "shm:") == 0);
+    bool                       interactive = isatty(STDOUT_FILENO);
+
+    // Register names are a convenience when every register was given as an address
+    loadSymbols(false);
+
+    // Build the list of registers to sample.  Each may be followed by "@<period>", or by
+    // "@<min>..<max>" to sample adaptively; those that aren't are sampled every 'samplePeriodUs'
+    for (auto& arg : args)
+    {
+        size_t   at       = arg.find('@');
+        uint64_t periodUs = samplePeriodUs, maxPeriodUs = 0;
+        if (at != string::npos)
+        {
+            string spec  = arg.substr(at + 1);
+            size_t range = spec.find("..");
+            periodUs = parsePeriod(spec.substr(0, range));
+            if (range != string::npos)
+            {
+                maxPeriodUs = parsePeriod(spec.substr(range + 2));
+                if (maxPeriodUs < periodUs) throw runtime_error("pcireg : bad sampling range "+spec);
+            }
+        }
+        addChannels(channels, arg.substr(0, at), periodUs, maxPeriodUs, regionSize);
+    }
 
-        // The 2nd token on the line is the name of the register
-        string& registerName = token[1];
+    // Adaptive channels are the ones whose period can vary
+    vector<size_t> adaptive;
+    for (size_t i=0; i<channels.size(); ++i)
+    {
+        if (channels[i].maxPeriodUs > channels[i].periodUs) adaptive.push_back(i);
+    }
 
-        // If this is the symbol we're looking for...
-        if (registerName == symbol)
+    // Create the output file.  Each adaptive channel gets an extra column that records the
+    // period in effect (in microseconds) when each of its values was read.
+    if (toRing)
+    {
+        vector<SampleRing::channel_t> table(channels.size());
+        for (size_t i=0; i<channels.size(); ++i)
         {
-            // Done with the input file
-            fclose(ifile);
-        
-            // The 3rd token on the line is the 64-bit address of the register
-            return strtoull(token[2].c_str(), nullptr, 0);
+            strncpy(table[i].name, channels[i].name.c_str(), sizeof(table[i].name) - 1);
+            table[i].axiAddr = channels[i].axiAddr;
+        }
+        for (auto i : adaptive) table[i].periodUs = channels[i].periodUs;
+        ring.create(sampleFile.substr(4), table);
+    }
+    else if (!toStdout)
+    {
+        vector<TSStore::column_t> columns;
+        for (auto& channel : channels) columns.push_back({channel.name, channel.axiAddr});
+        for (auto i : adaptive) columns.push_back({channels[i].name + "@period_us", 0xFFFFFFFF});
+        writer.create(sampleFile, columns);
+    }
+
+    vector<uint32_t> row(channels.size() + adaptive.size());
+    vector<uint64_t> lastPeriod(channels.size(), 0);
+    vector<uint32_t> newPeriod(channels.size(), 0);
+    vector<bool>     periodChanged(channels.size(), false);
+
+    // Ctrl-C ends sampling cleanly so that the file gets its index
+    signal(SIGINT,  [](int) {Sampler::stop();});
+    signal(SIGTERM, [](int) {Sampler::stop();});
+
+    Sampler sampler(baseAddr, channels);
+    sampler.enablePerf(usePerf);
+
+    // If the user wants it, registers follow changes to the symbol files
+    SymbolWatcher watcher;
+    uint64_t      generation = 0;
+    if (watchSymbols) watcher.start(symbolFiles, threadCount, Symbols);
+
+    sampler.run(samplePeriodUs, sampleCount, [&](int64_t timestamp, const uint32_t* value,
+                                                 const vector<bool>& due)
+    {
+        // If new symbols have been swapped in, move any register that was relocated.  The
+        // change takes effect with the next sweep; the column keeps its original address.
+        if (watchSymbols && watcher.generation() != generation)
+        {
+            generation = watcher.generation();
+            SymbolWatcher::Reader symbols(watcher);
+
+            for (size_t i=0; i<channels.size(); ++i)
+            {
+                uint64_t symbolValue;
+                if (!symbols->find(channels[i].name, &symbolValue)) continue;
+
+                uint32_t addr = (uint32_t)(symbolValue & 0xFFFFFFFF);
+                if (addr == channels[i].axiAddr || addr >= regionSize) continue;
+
+                fprintf(stderr, "pcireg : %s moved from 0x%08X to 0x%08X\n", channels[i].name.c_str(),
+                        channels[i].axiAddr, addr);
+                channels[i].axiAddr = addr;
+                sampler.setAddress(i, addr);
+            }
+        }
+
+        // Subscribers get the values that were read, straight from the sweep, preceded by the
+        // new period of any adaptive channel whose period has changed
+        if (toRing)
+        {
+            bool anyChanged = false;
+            for (auto i : adaptive)
+            {
+                uint64_t periodUs = sampler.periodUs(i);
+                periodChanged[i]  = (periodUs != lastPeriod[i]);
+                anyChanged       |= periodChanged[i];
+                newPeriod[i]      = lastPeriod[i] = periodUs;
+            }
+
+            if (anyChanged) ring.publishPeriods(timestamp, newPeriod.data(), periodChanged);
+            ring.publish(timestamp, value, due);
+            return;
+        }
+
+        // A file gets a row per sweep.  A register that wasn't due repeats its last value,
+        // which costs next to nothing in a delta-encoded column.
+        if (!toStdout)
+        {
+            copy(value, value + channels.size(), row.begin());
+            for (size_t a=0; a<adaptive.size(); ++a)
+            {
+                row[channels.size() + a] = (uint32_t)sampler.periodUs(adaptive[a]);
+            }
+            writer.append(timestamp, row.data());
+            return;
+        }
+
+        // Machine-readable formats get one record per value that was read, plus a record
+        // whenever an adaptive channel's period changes
+        if (Out.format() != OutputWriter::FMT_TEXT)
+        {
+            for (size_t i=0; i<channels.size(); ++i)
+            {
+                if (!due[i]) continue;
+                Out.record(timestamp, channels[i].name, channels[i].axiAddr, value[i]);
+            }
+
+            for (auto i : adaptive)
+            {
+                uint64_t periodUs = sampler.periodUs(i);
+                if (periodUs == lastPeriod[i]) continue;
+                lastPeriod[i] = periodUs;
+                Out.period(timestamp, channels[i].name, channels[i].axiAddr, periodUs);
+            }
+        }
+
+        // Text gets one line per sweep, with a dash for each register that wasn't due
+        else
+        {
+            Out.putDec(timestamp);
+            for (size_t i=0; i<channels.size(); ++i)
+            {
+                if (!due[i])
+                {
+                    Out.put("          -");
+                    continue;
+                }
+                Out.put(" 0x");
+                Out.putHex(value[i], 8);
+            }
+            Out.put('\n');
         }
+
+        // If someone is watching, don't make them wait for the buffer to fill
+        if (interactive) Out.flush();
+    });
+
+    writer.close();
+    ring.close();
+    Out.flush();
+
+    fprintf(stderr, "pcireg : %lu sweeps of %lu registers, %lu missed sweeps, %lu reads in %lu runs\n",
+            sampler.sweeps(), channels.size(), sampler.overruns(), sampler.reads(), sampler.runs());
+
+    for (auto i : adaptive)
+    {
+        fprintf(stderr, "pcireg : %s read %lu times, changed %lu times, period now %lu us\n",
+                channels[i].name.c_str(), sampler.readCount(i), sampler.changes(i), sampler.periodUs(i));
     }
 
-    // We're done with the input file
-    fclose(ifile);
+    if (usePerf)
+    {
+        PerfCounters::print(stderr, "perf(sweep):", sampler.perfTotals(),
+                            sampler.reads());
+    }
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// toggle() - Samples a set of registers and reports, for every bit, how often it toggled, how
+//            often it was set, and whether it was stuck.  Bits are labeled with their field names.
+//
+// Each positional parameter is either a register (or field) name, an address, or a prefix that
+// selects every register whose name starts with it.  Sampling stops after 'sampleCount' sweeps,
+// or when the user hits Ctrl-C.
+//=================================================================================================
+void toggle(uint8_t* baseAddr, size_t regionSize)
+{
+    vector<Sampler::channel_t> channels;
+    int64_t                    tsFirst = 0, tsLast = 0;
+
+    loadSymbols(false);
+
+    // Build the list of registers to sample
+    for (auto& arg : args) addChannels(channels, arg, 0, 0, regionSize);
 
-    // And complain that we couldn't find the symbol
-    err = "pcireg : cant find "+symbol+" in "+symbolFile;
-    throw runtime_error(err);
+    // Ctrl-C ends sampling and shows the results
+    signal(SIGINT,  [](int) {Sampler::stop();});
+    signal(SIGTERM, [](int) {Sampler::stop();});
+
+    BitStats stats(channels.size());
+    Sampler  sampler(baseAddr, channels);
+
+    sampler.run(samplePeriodUs, sampleCount, [&](int64_t timestamp, const uint32_t* value,
+                                                 const vector<bool>&)
+    {
+        if (stats.samples() == 0) tsFirst = timestamp;
+        tsLast = timestamp;
+        stats.add(value);
+    });
+
+    double seconds = (tsLast - tsFirst) / 1e9;
+    auto   format  = Out.format();
+    char   text[160];
+
+    if (format == OutputWriter::FMT_BINARY)
+    {
+        throw runtime_error("pcireg : -toggle reports as text, csv or json");
+    }
+
+    if (format == OutputWriter::FMT_TEXT)
+    {
+        snprintf(text, sizeof text, "%lu samples of %lu registers in %.3f seconds\n\n",
+                 stats.samples(), channels.size(), seconds);
+        Out.put(text);
+        snprintf(text, sizeof text, "%-40s %5s %12s %12s %7s  %s\n", "register/field", "bit",
+                 "toggles", "toggles/s", "duty%", "stuck");
+        Out.put(text);
+    }
 
-    // This is just to keep the compiler happy
-    return 0;
+    if (format == OutputWriter::FMT_CSV)
+    {
+        Out.put("register,address,field,bit,toggles,toggles_per_s,duty_pct,stuck\n");
+    }
+
+    for (size_t r=0; r<channels.size(); ++r)
+    {
+        uint32_t addr      = channels[r].axiAddr;
+        uint32_t stuckLow  = stats.stuckLow(r);
+        uint32_t stuckHigh = stats.stuckHigh(r);
+
+        if (format == OutputWriter::FMT_TEXT)
+        {
+            Out.put(channels[r].name);
+            snprintf(text, sizeof text, " (0x%08X)  stuck-at-0 0x%08X  stuck-at-1 0x%08X\n",
+                     addr, stuckLow, stuckHigh);
+            Out.put(text);
+        }
+
+        // Label each bit with its field.  A register without fields is 32 one-bit fields.
+        vector<SymbolTable::field_t> fields = Symbols.fields(addr);
+        if (fields.empty()) for (int bit=0; bit<32; ++bit)
+        {
+            fields.push_back({"bit" + to_string(bit), (1U << 24) | ((uint32_t)bit << 16)});
+        }
+
+        for (auto& field : fields)
+        {
+            uint32_t width = (field.fieldSpec >> 24) & 0xFF;
+            uint32_t pos   = (field.fieldSpec >> 16) & 0xFF;
+            if (width == 0 || width > 32) width = 32;
+
+            for (uint32_t i=0; i<width && pos + i < 32; ++i)
+            {
+                int      bit     = pos + i;
+                uint64_t toggles = stats.toggles(r, bit);
+                double   rate    = seconds > 0 ? toggles / seconds : 0.0;
+                double   duty    = stats.samples() ? 100.0 * stats.ones(r, bit) / stats.samples() : 0;
+                string   label   = field.name;
+                if (width > 1) label += "[" + to_string(i) + "]";
+
+                const char* stuck = ((stuckLow >> bit) & 1) ? "0" : ((stuckHigh >> bit) & 1) ? "1" : "-";
+
+                switch (format)
+                {
+                    case OutputWriter::FMT_CSV:
+                        Out.put(channels[r].name);
+                        snprintf(text, sizeof text, ",0x%08X,", addr);
+                        Out.put(text);
+                        Out.put(label);
+                        snprintf(text, sizeof text, ",%i,%lu,%.1f,%.2f,%s\n", bit, toggles, rate,
+                                 duty, stuck);
+                        Out.put(text);
+                        break;
+
+                    case OutputWriter::FMT_JSON:
+                        Out.put("{\"register\":");
+                        Out.putJson(channels[r].name);
+                        snprintf(text, sizeof text, ",\"addr\":\"0x%08X\",\"field\":", addr);
+                        Out.put(text);
+                        Out.putJson(label);
+                        snprintf(text, sizeof text, ",\"bit\":%i,\"toggles\":%lu,\"rate\":%.1f,"
+                                 "\"duty\":%.2f,\"stuck\":\"%s\"}\n", bit, toggles, rate, duty, stuck);
+                        Out.put(text);
+                        break;
+
+                    default:
+                        snprintf(text, sizeof text, "  %-38s %5i %12lu %12.1f %7.2f  %s\n",
+                                 label.c_str(), bit, toggles, rate, duty, stuck);
+                        Out.put(text);
+                        break;
+                }
+            }
+        }
+    }
+
+    Out.flush();
 }
-//=============================================================================
+//=================================================================================================
+
+
+//=================================================================================================
+// query() - Computes statistics over a time-series file and prints one line per series
+//
+// Each positional parameter is a series: either the name of a column, or a field symbol
+// whose register is one of the columns.  With no positional parameters, every column is a
+// series.
+//=================================================================================================
+void query()
+{
+    TSReader                  reader;
+    vector<TSQuery::series_t> series;
+
+    reader.open(queryFile);
+    auto& columns = reader.columns();
+
+    // With no series on the command line, query every column
+    if (args.empty())
+    {
+        for (size_t c=0; c<columns.size(); ++c) series.push_back({columns[c].name, c, 0});
+    }
+
+    // Field names are resolved through the symbol file
+    else loadSymbols(false);
+
+    for (auto& arg : args)
+    {
+        size_t c;
+
+        // Is this the name of a column?
+        for (c=0; c<columns.size(); ++c) if (columns[c].name == arg) break;
+        if (c < columns.size())
+        {
+            series.push_back({arg, c, 0});
+            continue;
+        }
+
+        // Otherwise, it's a register or field that should be within one of the columns
+        uint64_t value     = resolveSymbol(arg);
+        uint32_t addr      = (uint32_t)(value & 0xFFFFFFFF);
+        uint32_t fieldSpec = (uint32_t)(value >> 32);
+        if (fieldSpec == 0x20000000) fieldSpec = 0;
+
+        for (c=0; c<columns.size(); ++c) if (columns[c].axiAddr == addr) break;
+        if (c == columns.size()) throw runtime_error("pcireg : "+arg+" was not sampled in "+queryFile);
+
+        series.push_back({arg, c, fieldSpec});
+    }
+
+    // Convert the time limits to nanoseconds
+    int64_t fromNs = (int64_t)(timeFrom * 1e9);
+    int64_t toNs   = (timeTo == 0) ? INT64_MAX : (int64_t)(timeTo * 1e9);
+
+    // By default, use every CPU we have
+    int threads = threadCount ? threadCount : std::max(1U, thread::hardware_concurrency());
+
+    auto result = TSQuery::run(reader, series, fromNs, toNs, threads, !noPercentiles);
+
+    printf("%-40s %10s %10s %10s %10s %14s %10s %10s %10s\n", "series", "samples", "min", "max",
+           "changes", "rate/s", "p50", "p90", "p99");
+
+    for (size_t s=0; s<series.size(); ++s)
+    {
+        auto& r = result[s];
+        printf("%-40s %10lu %10u %10u %10lu %14.3f", series[s].name.c_str(), r.samples, r.min,
+               r.max, r.changes, r.rate);
+        if (noPercentiles)
+            printf(" %10s %10s %10s\n", "-", "-", "-");
+        else
+            printf(" %10lu %10lu %10lu\n", r.histogram.percentile(50), r.histogram.percentile(90),
+                   r.histogram.percentile(99));
+    }
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// subscribe() - Reads the sweeps that "pcireg -sample shm:<name>" publishes, and outputs them
+//               the way "-sample -" would
+//
+// Any number of subscribers can read the same ring without costing the sampler anything.  One
+// that falls more than a ring behind loses records, and is told how many at the end.  Reading
+// stops after 'sampleCount' sweeps, when the sampler exits, or when the user hits Ctrl-C.
+//=================================================================================================
+void subscribe()
+{
+    SampleRing ring;
+    bool       interactive = isatty(STDOUT_FILENO);
+    uint64_t   sweeps = 0;
+
+    ring.open(subscribeName);
+
+    auto     table = ring.channels();
+    uint32_t count = ring.channelCount();
+
+    // Each adaptive channel's period, as of the last value we saw, and as of now.  We start
+    // with what the channel table says, for the values published before we joined.
+    vector<uint32_t> shownPeriod(count, 0), period(count);
+    for (uint32_t i=0; i<count; ++i) period[i] = __atomic_load_n(&table[i].periodUs, __ATOMIC_RELAXED);
+
+    // A text line is assembled from the records of one sweep
+    vector<uint32_t> row(count);
+    vector<bool>     rowDue(count, false);
+    int64_t          rowTimestamp = 0;
+    bool             rowPending = false;
+
+    auto finishRow = [&]()
+    {
+        if (!rowPending) return;
+        ++sweeps;
+        rowPending = false;
+        if (Out.format() != OutputWriter::FMT_TEXT) return;
+
+        Out.putDec(rowTimestamp);
+        for (uint32_t i=0; i<count; ++i)
+        {
+            if (!rowDue[i])
+            {
+                Out.put("          -");
+                continue;
+            }
+            Out.put(" 0x");
+            Out.putHex(row[i], 8);
+            rowDue[i] = false;
+        }
+        Out.put('\n');
+    };
+
+    signal(SIGINT,  [](int) {SampleRing::stop();});
+    signal(SIGTERM, [](int) {SampleRing::stop();});
+
+    while (!SampleRing::stopRequested() && (sampleCount == 0 || sweeps < sampleCount))
+    {
+        const SampleRing::record_t* r = ring.peek();
+
+        // If there's nothing new, let someone who's watching see what we have, and nap
+        if (r == nullptr)
+        {
+            if (ring.drained()) break;
+            if (interactive) Out.flush();
+            usleep(100);
+            continue;
+        }
+
+        // A record from a new sweep means we lost the end of the last one
+        if (rowPending && r->timestamp != rowTimestamp) finishRow();
+
+        // Copy out what we need, and only then find out whether it's any good
+        SampleRing::record_t copy = *r;
+        if (!ring.release(r)) continue;
+
+        // New periods are remembered until the first value read under them
+        if (copy.flags & SampleRing::PERIODS)
+        {
+            for (int n=0; n<copy.count; ++n)
+            {
+                if ((copy.due >> n) & 1 && copy.first + n < count) period[copy.first + n] = copy.value[n];
+            }
+            continue;
+        }
+
+        rowTimestamp = copy.timestamp;
+        rowPending   = true;
+
+        for (int n=0; n<copy.count; ++n)
+        {
+            if (!((copy.due >> n) & 1)) continue;
+            uint32_t i = copy.first + n;
+            if (i >= count) break;
+
+            // Machine-readable formats get a record for the value, preceded by one for the
+            // channel's period whenever that has changed
+            if (Out.format() != OutputWriter::FMT_TEXT)
+            {
+                if (period[i] != shownPeriod[i])
+                {
+                    shownPeriod[i] = period[i];
+                    Out.period(copy.timestamp, table[i].name, table[i].axiAddr, period[i]);
+                }
+                Out.record(copy.timestamp, table[i].name, table[i].axiAddr, copy.value[n]);
+            }
+            else
+            {
+                row[i]    = copy.value[n];
+                rowDue[i] = true;
+            }
+        }
+
+        if (copy.flags & SampleRing::LAST_IN_SWEEP) finishRow();
+    }
+
+    finishRow();
+    Out.flush();
+
+    fprintf(stderr, "pcireg : %lu sweeps received, %lu records lost to overruns\n",
+            sweeps, ring.lost());
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// complete() - Prints, one per line, the register and field names that start with
+//              'completePrefix', for the shell completion scripts
+//
+// Names are completed an underscore-separated word at a time, so a register name completes to
+// itself and to the stem of its fields.  The answers come from the cached symbol index, which
+// is only rebuilt when a symbol file changes.
+//=================================================================================================
+void complete()
+{
+    SymbolIndex index;
+
+    index.open(symbolFiles, SymbolIndex::defaultCacheDir());
+
+    for (auto& name : index.complete(completePrefix, true))
+    {
+        Out.put(name);
+        Out.put('\n');
+    }
+
+    Out.flush();
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// loadSymbols() - Loads and merges every symbol file into "Symbols", the first time it's called
+//
+// Passed: required = true if a symbol file that can't be loaded is fatal.  When it isn't, the
+//                    caller will make do with addresses alone.
+//
+// Warnings about the merge (such as two registers with the same address) go to stderr
+//=================================================================================================
+void loadSymbols(bool required)
+{
+    static bool loaded = false;
+
+    // We only ever need to do this once
+    if (loaded) return;
+    loaded = true;
+
+    try
+    {
+        Symbols.load(symbolFiles, threadCount);
+    }
+    catch (const std::exception&)
+    {
+        Symbols.clear();
+        if (required) throw;
+        return;
+    }
+
+    for (auto& warning : Symbols.warnings()) fprintf(stderr, "%s\n", warning.c_str());
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// symbolSource() - Returns the list of symbol files, for use in error messages
+//=================================================================================================
+string symbolSource()
+{
+    string result;
+    for (auto& path : symbolFiles) result += (result.empty() ? "" : ", ") + path;
+    return result;
+}
+//=================================================================================================
 
 